@@ -5,11 +5,17 @@
 
 static int topbar                   = 1;        /* -b  option; if 0, dmenu appears at bottom */
 static int fuzzy                    = 1;        /* -F  option; if 0, dmenu doesn't use fuzzy matching */
+static int matchthreads             = 0;        /* threads matching large inputs, 0 for one per CPU */
+static int streaming                = 0;        /* -a  option; if 1, stdin is read while the menu is shown */
+static unsigned int streaminterval  = 100;      /* ms between redraws while -a is reading stdin */
+static unsigned int imagecache      = 64;       /* MiB of decoded images kept around */
+static unsigned int imagethreads    = 2;        /* threads decoding images, 0 to decode while drawing */
 static int dmx                      = PADDING;  /* put dmenu at this x offset */
 static int dmy                      = PADDING;  /* put dmenu at this y offset (measured from the bottom if topbar is 0) */
 static const unsigned int alpha     = 0xe0;     /* Amount of opacity. 0xff is opaque */
 static unsigned int dmw             = 0;        /* make dmenu this wide */
 static const char *dynamic          = NULL;     /* -dy option; dynamic command to run on input change */
+static unsigned int dyndebounce     = 150;      /* ms of no typing before the -dy command runs again */
 static char *prompt                 = NULL;     /* -p  option; prompt to the left of input field */
 
 /*
@@ -23,8 +29,8 @@ static unsigned int border_width    = 0;
 
 /* -l option; if nonzero, dmenu uses vertical list with given number of lines */
 static unsigned int lines           = 0;
-static unsigned int maxhist         = 64;
-static int histnodup                = 1;        /* if 0, record repeated histories */
+static unsigned int maxhist         = 64;       /* history entries kept when the file is compacted */
+static int histrank                 = 0;        /* if 1, items chosen often and recently rank first */
 
 /* -h option; minimum height of a menu line */
 static unsigned int lineheight      = 0;
@@ -1,14 +1,25 @@
 /* See LICENSE file for copyright and license details. */
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xproto.h>
@@ -23,6 +34,7 @@
 #include <hangul.h>
 
 #include "drw.h"
+#include "index.h"
 #include "util.h"
 
 /* macros */
@@ -31,6 +43,10 @@
 #define TEXTW(X)              (drw_fontset_getwidth(drw, (X)) + lrpad)
 
 #define OPAQUE                0xffu
+#define MATCHSLICE            16384 /* fewest candidates per matching thread */
+#define READCHUNK             65536 /* bytes read from stdin at a time */
+#define ARENASIZE             (1 << 20)
+#define HISTHALFLIFE          30 /* days until a choice counts half for histrank */
 
 /* enums */
 enum { SchemeNorm, SchemeSel, SchemeCaret, SchemeCursor, SchemeNormHighlight, SchemeSelHighlight,
@@ -40,7 +56,25 @@ struct item {
 	char *text;
 	struct item *left, *right;
 	int out;
+	unsigned int width; /* TEXTW(text) once known, 0 before */
 	double distance;
+	double rank; /* how often and recently it was chosen, see histrank */
+};
+
+/* the matches of one input text, kept so that typing narrows them */
+struct matchset {
+	char *text;
+	struct item **set; /* in input order */
+	struct item **ord; /* in menu order */
+	size_t n, ne, np; /* matches, exact matches, prefixes */
+};
+
+/* the part of the candidates one thread matches */
+struct matchslice {
+	struct item **cand;
+	size_t from, to;
+	struct item **set, **ord; /* outputs, n matches in each */
+	size_t n, ne, np; /* matches, exact matches, prefixes */
 };
 
 typedef struct {
@@ -56,6 +90,38 @@ static int lrpad; /* sum of left and right padding */
 static int tbpad; /* sum of top and bottom padding for images */
 static size_t cursor;
 static struct item *items = NULL;
+static size_t nitems, itemcap;
+static size_t nmatched; /* items visible to match(), see matchnew() */
+static int streamfd = -1; /* stdin while it is read in the background */
+static int imagefd = -1; /* readable when decoded images are waiting */
+static pid_t dynpid = -1; /* the -dy command running */
+static int dynfd = -1; /* and its output */
+static int dynqueued, dynfresh; /* a run is due at dyndue, no output yet */
+static unsigned int dynruns;
+static struct timespec dyndue;
+
+/* item texts are kept in a few large blocks, not one malloc per line */
+struct arena {
+	struct arena *next;
+	size_t len, size;
+	char buf[];
+};
+static struct arena *arena;
+static size_t partial; /* start of an unfinished line in arena */
+static char *mapped; /* stdin, if it is a regular file */
+static size_t mappedsize;
+static struct matchset *matchsets;
+static size_t nmatchsets, matchsetcap;
+static char **tokv;
+static int tokc, tokn;
+
+/* matching threads */
+static struct matchslice *slices;
+static int nslices, nworkers, pooldone;
+static unsigned long poolgen;
+static pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t donecond = PTHREAD_COND_INITIALIZER;
 static struct item *matches, *matchend;
 static struct item *prev, *curr, *next, *sel;
 static int mon = -1, screen;
@@ -110,6 +176,12 @@ ucs4str_to_utf8(const ucschar *ucs, char *buf, int bufsize)
 
 static void insert(const char *str, ssize_t n);
 static void drawmenu(void);
+static void popmatches(void);
+static void freeitems(void);
+static ssize_t readitems(int fd);
+static void matchnew(size_t from);
+static void dynreap(void);
+static void dynstop(void);
 
 static void
 hangul_commit(void)
@@ -131,8 +203,21 @@ static int depth;
 static Colormap cmap;
 
 static char *histfile;
-static char **history;
-static size_t histsz, histpos;
+
+/* history entries, oldest first, hashed by their text in histtab */
+struct histent {
+	char *text;
+	unsigned long count;
+	long long last; /* time of the last choice */
+	size_t seq;     /* line of the last choice, for choices within a second */
+	double rank;
+};
+static char *histbuf;
+static struct histent *hist;
+static size_t nhist, histcap, histpos, nhistlines;
+static size_t *histtab, histtabsize; /* index + 1 into hist, 0 if free */
+static int histeol = 1; /* the file ends with a newline */
+static size_t nranked; /* items with a history rank */
 
 /* Xresources preferences */
 enum resource_type {
@@ -168,6 +253,23 @@ textw_clamp(const char *str, unsigned int n, unsigned int maxw, unsigned int max
 	return MIN(w, n);
 }
 
+static unsigned int
+itemw(struct item *item)
+{
+	if (!item->width)
+		item->width = TEXTW(item->text);
+	return item->width;
+}
+
+/* textw_clamp() for an item, with the text width remembered */
+static unsigned int
+itemw_clamp(struct item *item, unsigned int n, unsigned int maxw, unsigned int maxh)
+{
+	if (startswith(image_prefix, item->text))
+		return textw_clamp(item->text, n, maxw, maxh);
+	return MIN(itemw(item), n);
+}
+
 static unsigned int
 texth_clamp(const char *str, unsigned int n, unsigned int maxw, unsigned int maxh)
 {
@@ -191,10 +293,28 @@ appenditem(struct item *item, struct item **list, struct item **last)
 	*last = item;
 }
 
+static unsigned int
+itemsize(struct item *item, unsigned int n)
+{
+	return (lines > 0)
+		? texth_clamp(item->text, n, mw - lrpad, image_size)
+		: itemw_clamp(item, n, image_size, bh);
+}
+
+static void
+prefetchimage(struct item *item)
+{
+	if (startswith(image_prefix, item->text))
+		drw_image_prefetch(drw, item->text + strlen(image_prefix),
+		                   lines > 0 ? mw - lrpad : image_size,
+		                   lines > 0 ? image_size : bh);
+}
+
 static void
 calcoffsets(void)
 {
 	int i, n;
+	struct item *item;
 
 	if (lines > 0)
 		n = mh - bh;
@@ -202,15 +322,19 @@ calcoffsets(void)
 		n = mw - (promptw + inputw + TEXTW("<") + TEXTW(">"));
 	/* calculate which items will begin the next page and previous page */
 	for (i = 0, next = curr; next; next = next->right)
-		if ((i += (lines > 0)
-					? texth_clamp(next->text, n, mw - lrpad, image_size)
-					: textw_clamp(next->text, n, image_size, bh)) > n)
+		if ((i += itemsize(next, n)) > n)
 			break;
 	for (i = 0, prev = curr; prev && prev->left; prev = prev->left)
-		if ((i += (lines > 0)
-					? texth_clamp(prev->left->text, n, mw - lrpad, image_size)
-					: textw_clamp(prev->left->text, n, image_size, bh)) > n)
+		if ((i += itemsize(prev->left, n)) > n)
+			break;
+	/* decode the images of both neighbouring pages ahead of time */
+	for (item = prev; item && item != curr; item = item->right)
+		prefetchimage(item);
+	for (i = 0, item = next; item; item = item->right) {
+		if ((i += itemsize(item, n)) > n)
 			break;
+		prefetchimage(item);
+	}
 }
 
 static void
@@ -219,11 +343,12 @@ cleanup(void)
 	size_t i;
 
 	XUngrabKeyboard(dpy, CurrentTime);
+	dynstop();
 	for (i = 0; i < SchemeLast; i++)
 		free(scheme[i]);
-	for (i = 0; items && items[i].text; ++i)
-		free(items[i].text);
+	freeitems();
 	free(items);
+	free(matchsets);
 	drw_free(drw);
 	XSync(dpy, False);
 	XCloseDisplay(dpy);
@@ -396,7 +521,7 @@ drawmenu(void)
 		}
 		x += w;
 		for (item = curr; item != next; item = item->right)
-			x = drawitem(item, x, 0, textw_clamp(item->text, mw - x - TEXTW(">"), image_size, bh));
+			x = drawitem(item, x, 0, itemw_clamp(item, mw - x - TEXTW(">"), image_size, bh));
 		if (next) {
 			w = TEXTW(">");
 			drw_setscheme(drw, scheme[SchemeNorm]);
@@ -441,10 +566,8 @@ grabkeyboard(void)
 	die("cannot grab keyboard");
 }
 
-static void readstdin(FILE* stream);
-
-static void
-refreshoptions()
+static char *
+dyncommand(void)
 {
 	int dynlen = strlen(dynamic);
 	int cmdlen = dynlen + 4;
@@ -472,14 +595,97 @@ refreshoptions()
 	}
 	*(c++) = '\'';
 	*(c++) = 0;
-	FILE *stream = popen(cmd, "r");
-	if (!stream)
-		die("could not popen dynamic command (%s):", cmd);
-	readstdin(stream);
-	int r = pclose(stream);
-	if (r == -1)
-		die("could not pclose dynamic command");
+	return cmd;
+}
+
+/* reap the command once it has closed its output, without waiting for it
+ * to exit, see run() */
+static void
+dynreap(void)
+{
+	if (dynpid > 0 && dynfd < 0 && waitpid(dynpid, NULL, WNOHANG) != 0)
+		dynpid = -1;
+}
+
+/* kill the command of an older text along with its children */
+static void
+dynstop(void)
+{
+	if (dynpid <= 0)
+		return;
+	kill(-dynpid, SIGKILL);
+	if (dynfd >= 0)
+		close(dynfd);
+	while (waitpid(dynpid, NULL, 0) == -1 && errno == EINTR)
+		;
+	dynpid = -1;
+	dynfd = -1;
+}
+
+/* run the command once typing pauses for dyndebounce ms, see run() */
+static void
+refreshoptions(void)
+{
+	dynstop();
+	clock_gettime(CLOCK_MONOTONIC, &dyndue);
+	if (dynruns) {
+		dyndue.tv_nsec += (long)dyndebounce * 1000000;
+		dyndue.tv_sec += dyndue.tv_nsec / 1000000000;
+		dyndue.tv_nsec %= 1000000000;
+	}
+	dynqueued = 1;
+}
+
+static void
+dynstart(void)
+{
+	char *cmd = dyncommand();
+	int fd[2];
+
+	dynqueued = 0;
+	if (pipe(fd) == -1)
+		die("pipe:");
+	if ((dynpid = fork()) == -1)
+		die("could not fork dynamic command (%s):", cmd);
+	if (dynpid == 0) {
+		/* its own process group, so its children are killed too */
+		setpgid(0, 0);
+		close(fd[0]);
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[1]);
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+		_exit(127);
+	}
+	setpgid(dynpid, dynpid); /* before a kill can race the child */
 	free(cmd);
+	close(fd[1]);
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	dynfd = fd[0];
+	dynfresh = 1;
+	dynruns++;
+}
+
+/* add what the command has printed, the items of the previous one stay
+ * until then */
+static void
+readdynamic(void)
+{
+	int fresh = dynfresh;
+
+	if (dynfresh) {
+		freeitems();
+		dynfresh = 0;
+	}
+	if (readitems(dynfd) == 0) {
+		close(dynfd);
+		dynfd = -1;
+		dynreap();
+	}
+	if (fresh) {
+		sel = NULL;
+		matchnew(0);
+		drawmenu();
+	}
 }
 
 int
@@ -493,23 +699,25 @@ compare_distance(const void *a, const void *b)
 	if (!da)
 		return -1;
 
-	return da->distance == db->distance ? 0 : da->distance < db->distance ? -1 : 1;
+	/* ties keep input order, whatever the qsort implementation */
+	if (da->distance == db->distance)
+		return da == db ? 0 : da < db ? -1 : 1;
+	return da->distance < db->distance ? -1 : 1;
 }
 
-void
-fuzzymatch(void)
+/* compute distances and keep the fuzzy matches of cand[from..to), in input order */
+static size_t
+fuzzymatch(struct item **cand, size_t from, size_t to, struct item **set)
 {
-	/* bang - we have so much memory */
 	struct item *it;
-	struct item **fuzzymatches = NULL;
 	char c;
-	int number_of_matches = 0, i, pidx, sidx, eidx;
+	size_t k, n = 0;
+	int i, pidx, sidx, eidx;
 	int text_len = strlen(text), itext_len;
 
-	matches = matchend = NULL;
-
-	/* walk through all items */
-	for (it = items; it && it->text; ++it) {
+	/* walk through all candidates */
+	for (k = from; k < to; k++) {
+		it = cand ? cand[k] : &items[k];
 		if (text_len) {
 			itext_len = strlen(it->text);
 			pidx = 0; /* pointer */
@@ -532,52 +740,340 @@ fuzzymatch(void)
 				/* compute distance */
 				/* add penalty if match starts late (log(sidx+2))
 				 * add penalty for long a match without many matching characters */
-				it->distance = log(sidx + 2) + (double)(eidx - sidx - text_len);
+				it->distance = log(sidx + 2) + (double)(eidx - sidx - text_len) - it->rank;
 				/* fprintf(stderr, "distance %s %f\n", it->text, it->distance); */
-				appenditem(it, &matches, &matchend);
-				++number_of_matches;
+				set[n++] = it;
 			}
 		} else {
-			appenditem(it, &matches, &matchend);
+			set[n++] = it;
 		}
 	}
+	return n;
+}
 
-	if (number_of_matches) {
-		/* initialize array with matches */
-		if (!(fuzzymatches = realloc(fuzzymatches,
-		                             number_of_matches * sizeof(struct item *))))
-			die("cannot realloc %u bytes:", number_of_matches * sizeof(struct item *));
-		for (i = 0, it = matches; it && i < number_of_matches; ++i, it = it->right)
-			fuzzymatches[i] = it;
-		/* sort matches according to distance */
-		qsort(fuzzymatches, number_of_matches, sizeof(struct item*), compare_distance);
-		/* rebuild list of matches */
-		matches = matchend = NULL;
-		for (i = 0, it = fuzzymatches[i]; i < number_of_matches && it &&
-		        it->text; ++i, it = fuzzymatches[i])
-			appenditem(it, &matches, &matchend);
-		free(fuzzymatches);
+/* separate input text into tokens to be matched individually */
+static void
+tokenize(void)
+{
+	static char buf[sizeof text];
+	char *s;
+
+	strcpy(buf, text);
+	tokc = 0;
+	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
+		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
+			die("cannot realloc %zu bytes:", tokn * sizeof *tokv);
+}
+
+/* keep the items of cand[from..to) matching every token, in input order */
+static size_t
+tokenmatch(struct item **cand, size_t from, size_t to, struct item **set)
+{
+	int i;
+	size_t k, n = 0;
+	struct item *it;
+
+	for (k = from; k < to; k++) {
+		it = cand ? cand[k] : &items[k];
+		for (i = 0; i < tokc; i++)
+			if (!fstrstr(it->text, tokv[i]))
+				break;
+		if (i == tokc) /* all tokens match */
+			set[n++] = it;
 	}
-	curr = sel = matches;
-	calcoffsets();
+	return n;
 }
 
+/*
+ * Order a token match set: exact matches go first, then prefixes, then
+ * substrings. Returns the number of exact matches and prefixes in *ne
+ * and *np.
+ */
 static void
-match(void)
+tokenorder(struct item **set, size_t n, struct item **ord, size_t *ne, size_t *np)
+{
+	size_t k, ns = 0, len, textsize;
+	struct item **tmp;
+
+	len = tokc ? strlen(tokv[0]) : 0;
+	textsize = strlen(text) + 1;
+
+	/* prefixes fill tmp from the front, substrings from the back */
+	tmp = ecalloc(MAX(n, 1), sizeof *tmp);
+	*ne = *np = 0;
+	for (k = 0; k < n; k++) {
+		if (!tokc || !fstrncmp(text, set[k]->text, textsize))
+			ord[(*ne)++] = set[k];
+		else if (!fstrncmp(tokv[0], set[k]->text, len))
+			tmp[(*np)++] = set[k];
+		else
+			tmp[n - ++ns] = set[k];
+	}
+	memcpy(ord + *ne, tmp, *np * sizeof *tmp);
+	for (k = 0; k < ns; k++)
+		ord[*ne + *np + k] = tmp[n - 1 - k];
+	free(tmp);
+}
+
+/* match and order one slice of the candidates */
+static void
+matchslice(struct matchslice *s)
 {
 	if (fuzzy) {
-		fuzzymatch();
+		s->n = fuzzymatch(s->cand, s->from, s->to, s->set);
+		memcpy(s->ord, s->set, s->n * sizeof *s->ord);
+		if (text[0])
+			qsort(s->ord, s->n, sizeof *s->ord, compare_distance);
+		/* without text everything stays in input order */
+		s->ne = text[0] ? 0 : s->n;
+		s->np = 0;
+	} else {
+		s->n = tokenmatch(s->cand, s->from, s->to, s->set);
+		tokenorder(s->set, s->n, s->ord, &s->ne, &s->np);
+	}
+}
+
+static void *
+matchworker(void *arg)
+{
+	int id = (intptr_t)arg;
+	unsigned long gen = 0;
+
+	pthread_mutex_lock(&poollock);
+	for (;;) {
+		while (poolgen == gen)
+			pthread_cond_wait(&poolcond, &poollock);
+		gen = poolgen;
+		if (id < nslices) {
+			pthread_mutex_unlock(&poollock);
+			matchslice(&slices[id]);
+			pthread_mutex_lock(&poollock);
+		}
+		if (++pooldone == nworkers)
+			pthread_cond_signal(&donecond);
+	}
+	return NULL;
+}
+
+/* run matchslice() on every slice, slice 0 on the calling thread */
+static void
+runslices(void)
+{
+	pthread_mutex_lock(&poollock);
+	pooldone = 0;
+	poolgen++;
+	pthread_cond_broadcast(&poolcond);
+	pthread_mutex_unlock(&poollock);
+
+	matchslice(&slices[0]);
+
+	pthread_mutex_lock(&poollock);
+	while (pooldone < nworkers)
+		pthread_cond_wait(&donecond, &poollock);
+	pthread_mutex_unlock(&poollock);
+}
+
+static void
+startworkers(void)
+{
+	pthread_t t;
+	long n;
+	int i;
+
+	if ((n = matchthreads) <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	n = MAX(MIN(n, 64), 1);
+	slices = ecalloc(n, sizeof *slices);
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&t, NULL, matchworker, (void *)(intptr_t)i))
+			break;
+		pthread_detach(t);
+	}
+	nworkers = i - 1;
+}
+
+/*
+ * Merge the per slice menu orders into ord. Concatenating the slices
+ * keeps every match in input order, so taking ties from the earlier
+ * slice gives the same order as one sort over all matches.
+ */
+static void
+mergeslices(struct item **ord)
+{
+	struct matchslice *s;
+	size_t k = 0, pos[64] = {0};
+	int i, best;
+
+	if (!fuzzy || !text[0]) {
+		for (i = 0; i < nslices; i++) {
+			s = &slices[i];
+			memcpy(ord + k, s->ord, s->ne * sizeof *ord);
+			k += s->ne;
+		}
+		for (i = 0; i < nslices; i++) {
+			s = &slices[i];
+			memcpy(ord + k, s->ord + s->ne, s->np * sizeof *ord);
+			k += s->np;
+		}
+		for (i = 0; i < nslices; i++) {
+			s = &slices[i];
+			memcpy(ord + k, s->ord + s->ne + s->np,
+			       (s->n - s->ne - s->np) * sizeof *ord);
+			k += s->n - s->ne - s->np;
+		}
 		return;
 	}
-	static char **tokv = NULL;
-	static int tokn = 0;
 
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
-	size_t len, textsize;
-	struct item *item, *lprefix, *lsubstr, *prefixend, *substrend;
+	for (;;) {
+		best = -1;
+		for (i = 0; i < nslices; i++) {
+			if (pos[i] == slices[i].n)
+				continue;
+			if (best < 0 || compare_distance(&slices[i].ord[pos[i]],
+			    &slices[best].ord[pos[best]]) < 0)
+				best = i;
+		}
+		if (best < 0)
+			break;
+		ord[k++] = slices[best].ord[pos[best]++];
+	}
+}
+
+static int
+compare_rank(const void *a, const void *b)
+{
+	struct item *ra = *(struct item **) a;
+	struct item *rb = *(struct item **) b;
 
-	if (dynamic) {
+	if (ra->rank == rb->rank)
+		return ra == rb ? 0 : ra < rb ? -1 : 1;
+	return ra->rank > rb->rank ? -1 : 1;
+}
+
+/* move the items chosen before to the front of ord[0..n), best first */
+static void
+rankrun(struct item **ord, size_t n)
+{
+	struct item **ranked;
+	size_t i, j, r = 0;
+
+	for (i = 0; i < n; i++)
+		r += ord[i]->rank > 0;
+	if (!r)
+		return;
+	ranked = ecalloc(r, sizeof *ranked);
+	for (i = 0, j = 0; i < n; i++)
+		if (ord[i]->rank > 0)
+			ranked[j++] = ord[i];
+	for (i = n, j = n; i-- > 0;)
+		if (!(ord[i]->rank > 0))
+			ord[--j] = ord[i];
+	qsort(ranked, r, sizeof *ranked, compare_rank);
+	memcpy(ord, ranked, r * sizeof *ord);
+	free(ranked);
+}
+
+/*
+ * Boost the items chosen before, see histrank. Fuzzy distances take
+ * the rank into account already, exact matches, prefixes and substrings
+ * each put theirs first.
+ */
+static void
+rankmatches(struct matchset *m)
+{
+	if (!nranked || (fuzzy && text[0]))
+		return;
+	rankrun(m->ord, m->ne);
+	rankrun(m->ord + m->ne, m->np);
+	rankrun(m->ord + m->ne + m->np, m->n - m->ne - m->np);
+}
+
+static void
+linkmatches(struct item **ord, size_t n)
+{
+	size_t k;
+
+	matches = matchend = NULL;
+	for (k = 0; k < n; k++)
+		appenditem(ord[k], &matches, &matchend);
+	curr = sel = matches;
+	calcoffsets();
+}
+
+static void
+popmatches(void)
+{
+	struct matchset *m = &matchsets[--nmatchsets];
+
+	free(m->text);
+	free(m->set);
+	free(m->ord);
+}
+
+/*
+ * Match cand[from..to), or the items when cand is NULL, and return the
+ * matches in input order in *setp and in menu order in *ordp. *ne and
+ * *np get the number of leading exact matches and prefixes.
+ */
+static size_t
+matchcands(struct item **cand, size_t from, size_t to,
+           struct item ***setp, struct item ***ordp, size_t *ne, size_t *np)
+{
+	struct matchslice *s;
+	struct item **set, **ord, **tmp;
+	size_t n, per, ncand = to - from;
+	int i;
+
+	if (!fuzzy)
+		tokenize();
+
+	/* large inputs are cut into slices matched on the worker threads */
+	if (!slices)
+		startworkers();
+	nslices = MIN(nworkers + 1, MAX(ncand / MATCHSLICE, 1));
+	per = (ncand + nslices - 1) / nslices;
+
+	set = ecalloc(MAX(ncand, 1), sizeof *set);
+	tmp = ecalloc(MAX(ncand, 1), sizeof *tmp);
+	for (i = 0; i < nslices; i++) {
+		s = &slices[i];
+		s->cand = cand;
+		s->from = from + MIN(i * per, ncand);
+		s->to = MIN(s->from + per, to);
+		s->set = set + (s->from - from);
+		s->ord = tmp + (s->from - from);
+	}
+	if (nslices > 1)
+		runslices();
+	else
+		matchslice(&slices[0]);
+
+	/* close the gaps between the slices */
+	for (i = 0, n = 0, *ne = *np = 0; i < nslices; i++) {
+		memmove(set + n, slices[i].set, slices[i].n * sizeof *set);
+		n += slices[i].n;
+		*ne += slices[i].ne;
+		*np += slices[i].np;
+	}
+	if (!(set = realloc(set, MAX(n, 1) * sizeof *set)))
+		die("cannot realloc %zu bytes:", MAX(n, 1) * sizeof *set);
+	ord = ecalloc(MAX(n, 1), sizeof *ord);
+	mergeslices(ord);
+	free(tmp);
+
+	*setp = set;
+	*ordp = ord;
+	return n;
+}
+
+static void
+match(void)
+{
+	struct matchset *m;
+	struct item *item, **cand = NULL;
+	size_t ncand = nmatched;
+
+	if (dynamic && !fuzzy) {
 		refreshoptions();
 		matches = matchend = NULL;
 		for (item = items; item && item->text; item++)
@@ -587,47 +1083,133 @@ match(void)
 		return;
 	}
 
-	strcpy(buf, text);
-	/* separate input text into tokens to be matched individually */
-	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
-		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
-			die("cannot realloc %zu bytes:", tokn * sizeof *tokv);
-	len = tokc ? strlen(tokv[0]) : 0;
+	/*
+	 * Appending to the text can only drop matches, so narrow the set
+	 * of the longest earlier text that is a prefix of this one. Sets
+	 * of texts that are not are dropped, so deleting back to an
+	 * earlier text finds its set on top of the stack.
+	 */
+	while (nmatchsets && strncmp(matchsets[nmatchsets - 1].text, text,
+	                             strlen(matchsets[nmatchsets - 1].text)))
+		popmatches();
+	if (nmatchsets) {
+		m = &matchsets[nmatchsets - 1];
+		if (!strcmp(m->text, text)) {
+			linkmatches(m->ord, m->n);
+			return;
+		}
+		cand = m->set;
+		ncand = m->n;
+	}
 
-	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
-	textsize = strlen(text) + 1;
-	for (item = items; item && item->text; item++) {
-		for (i = 0; i < tokc; i++)
-			if (!fstrstr(item->text, tokv[i]))
-				break;
-		if (i != tokc) /* not all tokens match */
-			continue;
-		/* exact matches go first, then prefixes, then substrings */
-		if (!tokc || !fstrncmp(text, item->text, textsize))
-			appenditem(item, &matches, &matchend);
-		else if (!fstrncmp(tokv[0], item->text, len))
-			appenditem(item, &lprefix, &prefixend);
-		else
-			appenditem(item, &lsubstr, &substrend);
-	}
-	if (lprefix) {
-		if (matches) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
-		} else
-			matches = lprefix;
-		matchend = prefixend;
-	}
-	if (lsubstr) {
-		if (matches) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
-		} else
-			matches = lsubstr;
-		matchend = substrend;
+	if (nmatchsets == matchsetcap) {
+		matchsetcap = matchsetcap ? matchsetcap * 2 : 16;
+		if (!(matchsets = realloc(matchsets, matchsetcap * sizeof *matchsets)))
+			die("cannot realloc %zu bytes:", matchsetcap * sizeof *matchsets);
+	}
+	m = &matchsets[nmatchsets];
+	m->n = matchcands(cand, 0, ncand, &m->set, &m->ord, &m->ne, &m->np);
+	if (!(m->text = strdup(text)))
+		die("strdup:");
+	nmatchsets++;
+	rankmatches(m);
+	linkmatches(m->ord, m->n);
+}
+
+/*
+ * Add the matches among the items from index from on, which were read
+ * after the last match(). Only the set of the current text is kept, the
+ * earlier ones do not know about the new items.
+ */
+static void
+matchnew(size_t from)
+{
+	struct matchset *m, top;
+	struct item **set, **ord, **nset, **nord, *osel = sel, *ocurr = curr, *it;
+	size_t n, ne, np, a, b, k;
+
+	if (dynamic && !fuzzy) {
+		/* more output of the -dy command, the selection stays */
+		nmatched = nitems;
+		lines = MIN(max_lines, nitems);
+		matches = matchend = NULL;
+		for (it = items; it && it->text; it++)
+			appenditem(it, &matches, &matchend);
+		if (!sel)
+			curr = sel = matches;
+		calcoffsets();
+		return;
+	}
+	if (!nmatchsets || strcmp(matchsets[nmatchsets - 1].text, text)) {
+		nmatched = nitems;
+		while (nmatchsets)
+			popmatches();
+		match();
+		return;
+	}
+	top = matchsets[--nmatchsets];
+	while (nmatchsets)
+		popmatches();
+	matchsets[nmatchsets++] = top;
+	m = &matchsets[0];
+
+	/* earlier texts may have overwritten the distances of this set */
+	if (fuzzy && text[0] && m->n) {
+		set = ecalloc(m->n, sizeof *set);
+		fuzzymatch(m->set, 0, m->n, set);
+		free(set);
+	}
+	n = matchcands(NULL, from, nitems, &nset, &nord, &ne, &np);
+	nmatched = nitems;
+
+	set = ecalloc(MAX(m->n + n, 1), sizeof *set);
+	memcpy(set, m->set, m->n * sizeof *set);
+	memcpy(set + m->n, nset, n * sizeof *set);
+	ord = ecalloc(MAX(m->n + n, 1), sizeof *ord);
+	if (fuzzy && text[0]) {
+		for (a = b = k = 0; a < m->n || b < n; k++)
+			ord[k] = b == n || (a < m->n && compare_distance(&m->ord[a],
+			         &nord[b]) < 0) ? m->ord[a++] : nord[b++];
+	} else {
+		/* exact matches, prefixes and substrings of both in turn */
+		k = 0;
+		memcpy(ord + k, m->ord, m->ne * sizeof *ord);
+		k += m->ne;
+		memcpy(ord + k, nord, ne * sizeof *ord);
+		k += ne;
+		memcpy(ord + k, m->ord + m->ne, m->np * sizeof *ord);
+		k += m->np;
+		memcpy(ord + k, nord + ne, np * sizeof *ord);
+		k += np;
+		memcpy(ord + k, m->ord + m->ne + m->np,
+		       (m->n - m->ne - m->np) * sizeof *ord);
+		k += m->n - m->ne - m->np;
+		memcpy(ord + k, nord + ne + np, (n - ne - np) * sizeof *ord);
+	}
+	free(nset);
+	free(nord);
+	free(m->set);
+	free(m->ord);
+	m->set = set;
+	m->ord = ord;
+	m->n += n;
+	m->ne += ne;
+	m->np += np;
+	rankmatches(m);
+
+	/* keep the selection and the page the user is looking at */
+	linkmatches(m->ord, m->n);
+	if (osel && ocurr) {
+		curr = ocurr;
+		calcoffsets();
+		for (it = curr; it && it != next && it != osel; it = it->right)
+			;
+		if (it != osel) {
+			curr = osel;
+			calcoffsets();
+		}
+		sel = osel;
 	}
-	curr = sel = matches;
-	calcoffsets();
 }
 
 static void
@@ -670,50 +1252,158 @@ movewordedge(int dir)
 	}
 }
 
+static size_t
+histhash(const char *s)
+{
+	size_t h = 2166136261u;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+/* find text in the history, hist + nhist if it is not there */
+static struct histent *
+histfind(const char *text)
+{
+	size_t i;
+
+	if (!histtabsize)
+		return hist + nhist;
+	for (i = histhash(text) & (histtabsize - 1); histtab[i];
+	     i = (i + 1) & (histtabsize - 1))
+		if (!strcmp(hist[histtab[i] - 1].text, text))
+			return &hist[histtab[i] - 1];
+	return hist + nhist;
+}
+
 static void
-loadhistory(void)
+histindex(void)
 {
-	FILE *fp = NULL;
-	static size_t cap = 0;
-	size_t llen;
-	char *line;
+	size_t i, k;
 
-	if (!histfile) {
-		return;
+	free(histtab);
+	for (histtabsize = 64; histtabsize < 2 * (nhist + 1); histtabsize *= 2)
+		;
+	histtab = ecalloc(histtabsize, sizeof *histtab);
+	for (k = 0; k < nhist; k++) {
+		for (i = histhash(hist[k].text) & (histtabsize - 1); histtab[i];
+		     i = (i + 1) & (histtabsize - 1))
+			;
+		histtab[i] = k + 1;
 	}
+}
 
-	fp = fopen(histfile, "r");
-	if (!fp) {
-		return;
+/* the entry of text, added without any count if it is new */
+static struct histent *
+histget(char *text)
+{
+	struct histent *e;
+	size_t i;
+
+	if ((e = histfind(text)) < hist + nhist)
+		return e;
+	if (nhist == histcap) {
+		histcap = histcap ? histcap * 2 : 256;
+		if (!(hist = realloc(hist, histcap * sizeof *hist)))
+			die("cannot realloc %zu bytes:", histcap * sizeof *hist);
 	}
+	e = &hist[nhist++];
+	e->text = text;
+	e->count = 0;
+	e->last = 0;
+	e->seq = 0;
+	e->rank = 0;
+	if (2 * nhist >= histtabsize) {
+		histindex();
+	} else {
+		for (i = histhash(text) & (histtabsize - 1); histtab[i];
+		     i = (i + 1) & (histtabsize - 1))
+			;
+		histtab[i] = nhist;
+	}
+	return e;
+}
 
-	for (;;) {
-		line = NULL;
-		llen = 0;
-		if (-1 == getline(&line, &llen, fp)) {
-			if (ferror(fp)) {
-				die("failed to read history");
-			}
-			free(line);
-			break;
-		}
+static int
+histcmp(const void *a, const void *b)
+{
+	const struct histent *ha = a, *hb = b;
 
-		if (cap == histsz) {
-			cap += 64 * sizeof(char*);
-			history = realloc(history, cap);
-			if (!history) {
-				die("failed to realloc memory");
-			}
-		}
-		strtok(line, "\n");
-		history[histsz] = line;
-		histsz++;
-	}
-	histpos = histsz;
+	if (ha->last != hb->last)
+		return ha->last < hb->last ? -1 : 1;
+	return ha->seq < hb->seq ? -1 : ha->seq > hb->seq;
+}
 
-	if (fclose(fp)) {
+/* boost of an item chosen before, see histrank */
+static double
+histscore(const char *text)
+{
+	struct histent *e = histfind(text);
+
+	return e < hist + nhist ? e->rank : 0;
+}
+
+/*
+ * The history file has a line "count<TAB>time<TAB>text" per entry. Each
+ * choice is appended as a line of its own, the lines of one text are
+ * added up here and savehistory() compacts the file once it has twice
+ * maxhist lines. Lines without counts, as written by earlier versions,
+ * count once.
+ */
+static void
+loadhistory(void)
+{
+	FILE *fp;
+	struct stat st;
+	struct histent *e;
+	char *p, *nl, *t1, *t2, *n, *end;
+	unsigned long count;
+	long long last;
+	time_t now = time(NULL);
+
+	if (!histfile || !(fp = fopen(histfile, "r")))
+		return;
+	if (fstat(fileno(fp), &st) == -1)
+		die("failed to stat %s:", histfile);
+	histbuf = ecalloc(st.st_size + 1, 1);
+	if (fread(histbuf, 1, st.st_size, fp) != (size_t)st.st_size)
+		die("failed to read history");
+	histeol = !st.st_size || histbuf[st.st_size - 1] == '\n';
+	if (fclose(fp))
 		die("failed to close file %s", histfile);
+
+	end = histbuf + st.st_size;
+	for (p = histbuf; p < end; p = nl + 1) {
+		if (!(nl = memchr(p, '\n', end - p)))
+			nl = end;
+		*nl = '\0';
+		nhistlines++;
+		count = 1;
+		last = st.st_mtime;
+		if ((t1 = strchr(p, '\t')) && (t2 = strchr(t1 + 1, '\t')) &&
+		    (count = strtoul(p, &n, 10), n == t1 && n != p) &&
+		    (last = strtoll(t1 + 1, &n, 10), n == t2 && n != t1 + 1)) {
+			p = t2 + 1;
+		} else {
+			count = 1;
+			last = st.st_mtime;
+		}
+		if (!*p)
+			continue;
+		e = histget(p);
+		e->count += count;
+		e->last = MAX(e->last, last);
+		e->seq = nhistlines;
 	}
+
+	/* oldest first, Up goes back from the end */
+	qsort(hist, nhist, sizeof *hist, histcmp);
+	histindex();
+	for (e = hist; e < hist + nhist; e++)
+		e->rank = log(1 + e->count) *
+		          exp2(-(double)MAX(now - e->last, 0) / (HISTHALFLIFE * 86400.0));
+	histpos = nhist;
 }
 
 static void
@@ -723,25 +1413,25 @@ navhistory(int dir)
 	char *p = NULL;
 	size_t len = 0;
 
-	if (!history || histpos + 1 == 0)
+	if (!nhist || histpos + 1 == 0)
 		return;
 
-	if (histsz == histpos) {
+	if (nhist == histpos) {
 		strncpy(def, text, sizeof(def));
 	}
 
 	switch(dir) {
 	case 1:
-		if (histpos < histsz - 1) {
-			p = history[++histpos];
-		} else if (histpos == histsz - 1) {
+		if (histpos < nhist - 1) {
+			p = hist[++histpos].text;
+		} else if (histpos == nhist - 1) {
 			p = def;
 			histpos++;
 		}
 		break;
 	case -1:
 		if (histpos > 0) {
-			p = history[--histpos];
+			p = hist[--histpos].text;
 		}
 		break;
 	}
@@ -759,8 +1449,12 @@ navhistory(int dir)
 static void
 savehistory(char *input)
 {
-	unsigned int i;
+	char tmp[PATH_MAX];
+	struct histent *e;
+	size_t i;
 	FILE *fp;
+	int fd;
+	time_t now = time(NULL);
 
 	if (!histfile ||
 	    0 == maxhist ||
@@ -768,29 +1462,47 @@ savehistory(char *input)
 		goto out;
 	}
 
-	fp = fopen(histfile, "w");
-	if (!fp) {
-		die("failed to open %s", histfile);
-	}
-	for (i = histsz < maxhist ? 0 : histsz - maxhist; i < histsz; i++) {
-		if (0 >= fprintf(fp, "%s\n", history[i])) {
+	if (nhistlines + 1 < 2 * maxhist) {
+		/* a line for this choice is all that is written */
+		fp = fopen(histfile, "a");
+		if (!fp) {
+			die("failed to open %s", histfile);
+		}
+		if (0 >= fprintf(fp, "%s1\t%lld\t%s\n", histeol ? "" : "\n",
+		                 (long long)now, input)) {
 			die("failed to write to %s", histfile);
 		}
+		if (fclose(fp)) {
+			die("failed to close file %s", histfile);
+		}
+		goto out;
 	}
-	if (histsz == 0 || !histnodup || (histsz > 0 && strcmp(input, history[histsz-1]) != 0)) { /* TODO */
-		if (0 >= fputs(input, fp)) {
+
+	/* compact: one line per text, the maxhist last used ones */
+	e = histget(input);
+	e->count++;
+	e->last = now;
+	e->seq = nhistlines + 1;
+	qsort(hist, nhist, sizeof *hist, histcmp);
+	if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", histfile) >= (int)sizeof tmp ||
+	    (fd = mkstemp(tmp)) == -1 || !(fp = fdopen(fd, "w"))) {
+		die("failed to open %s", histfile);
+	}
+	for (i = nhist < maxhist ? 0 : nhist - maxhist; i < nhist; i++) {
+		if (0 >= fprintf(fp, "%lu\t%lld\t%s\n", hist[i].count,
+		                 hist[i].last, hist[i].text)) {
 			die("failed to write to %s", histfile);
 		}
 	}
-	if (fclose(fp)) {
-		die("failed to close file %s", histfile);
+	if (fclose(fp) || rename(tmp, histfile)) {
+		unlink(tmp);
+		die("failed to write to %s", histfile);
 	}
 
 out:
-	for (i = 0; i < histsz; i++) {
-		free(history[i]);
-	}
-	free(history);
+	free(hist);
+	free(histtab);
+	free(histbuf);
 }
 
 static void
@@ -1340,7 +2052,7 @@ buttonpress(XEvent *e)
 		/* horizontal list: (ctrl)left-click on item */
 		for (item = curr; item != next; item = item->right) {
 			x += w;
-			w = MIN(TEXTW(item->text), mw - x - TEXTW(">"));
+			w = MIN(itemw(item), mw - x - TEXTW(">"));
 			if (ev->x >= x && ev->x <= x + w) {
 				puts(item->text);
 				if (!(ev->state & ControlMask))
@@ -1388,7 +2100,7 @@ mousemove(XEvent *e)
 		w = TEXTW("<");
 		for (item = curr; item != next; item = item->right) {
 			x += w;
-			w = MIN(TEXTW(item->text), mw - x - TEXTW(">"));
+			w = MIN(itemw(item), mw - x - TEXTW(">"));
 			if (ev->x >= x && ev->x <= x + w) {
 				sel = item;
 				calcoffsets();
@@ -1419,36 +2131,218 @@ paste(void)
 	drawmenu();
 }
 
+/* point everything that pointed into the old item array at the new one */
+static void
+rebaseitems(struct item *old)
+{
+	uintptr_t d = (uintptr_t)items - (uintptr_t)old;
+	size_t i, k;
+
+#define REBASE(p) ((p) = (p) ? (struct item *)((uintptr_t)(p) + d) : NULL)
+	for (i = 0; i < nitems; i++) {
+		REBASE(items[i].left);
+		REBASE(items[i].right);
+	}
+	for (i = 0; i < nmatchsets; i++) {
+		for (k = 0; k < matchsets[i].n; k++) {
+			REBASE(matchsets[i].set[k]);
+			REBASE(matchsets[i].ord[k]);
+		}
+	}
+	REBASE(matches);
+	REBASE(matchend);
+	REBASE(prev);
+	REBASE(curr);
+	REBASE(next);
+	REBASE(sel);
+#undef REBASE
+}
+
+static void
+additem(char *s)
+{
+	struct item *old = items;
+
+	/* grow by copying, so old is still valid while it is rebased */
+	if (nitems + 1 >= itemcap) {
+		itemcap = itemcap ? itemcap * 2 : 4096;
+		if (!(items = malloc(itemcap * sizeof *items)))
+			die("cannot malloc %zu bytes:", itemcap * sizeof *items);
+		if (old) {
+			memcpy(items, old, (nitems + 1) * sizeof *items);
+			rebaseitems(old);
+			free(old);
+		}
+	}
+	items[nitems].text = s;
+	items[nitems].left = items[nitems].right = NULL;
+	items[nitems].out = 0;
+	items[nitems].width = 0;
+	items[nitems].rank = histrank && nhist ? histscore(s) : 0;
+	nranked += items[nitems].rank > 0;
+	items[++nitems].text = NULL;
+}
+
+/* start a new arena block with room for at least n more bytes */
+static void
+newarena(size_t n)
+{
+	struct arena *a;
+	size_t keep = arena ? arena->len - partial : 0;
+
+	n = MAX(ARENASIZE, keep + n);
+	if (!(a = malloc(sizeof *a + n)))
+		die("cannot malloc %zu bytes:", sizeof *a + n);
+	a->size = n;
+	a->len = keep;
+	/* a partial line moves along, the old block keeps the finished ones */
+	if (keep) {
+		memcpy(a->buf, arena->buf + partial, keep);
+		arena->len = partial;
+	}
+	partial = 0;
+	a->next = arena;
+	arena = a;
+}
+
+/*
+ * Read what fd has into the arena and add its complete lines as items.
+ * Returns what read() returned, at 0 a trailing partial line is added.
+ */
+static ssize_t
+readitems(int fd)
+{
+	char *p, *nl, *end;
+	ssize_t r;
+
+	if (!arena || arena->size - arena->len < READCHUNK + 1)
+		newarena(READCHUNK + 1);
+	/* one byte is always left for terminating a last partial line */
+	if ((r = read(fd, arena->buf + arena->len,
+	              arena->size - arena->len - 1)) == -1) {
+		if (errno == EINTR || errno == EAGAIN)
+			return -1;
+		die("read:");
+	}
+	end = arena->buf + arena->len + r;
+	for (p = arena->buf + partial; (nl = memchr(p, '\n', end - p)); p = nl + 1) {
+		*nl = '\0';
+		additem(p);
+	}
+	arena->len = end - arena->buf;
+	partial = p - arena->buf;
+	if (r == 0 && partial < arena->len) {
+		*end = '\0';
+		additem(arena->buf + partial);
+		partial = ++arena->len;
+	}
+	return r;
+}
+
+/* the names of a stest -i index are items as they are */
+static int
+indexitems(void)
+{
+	const struct indexhdr *h = (const struct indexhdr *)mapped;
+	const uint32_t *names;
+	uint32_t i;
+
+	if (mappedsize <= sizeof *h || memcmp(h->magic, INDEXMAGIC, sizeof h->magic) ||
+	    mapped[mappedsize - 1] != '\0' ||
+	    sizeof *h + (uint64_t)h->ndirs * sizeof(struct indexdir) +
+	    ((uint64_t)h->nentries + h->nnames) * sizeof(uint32_t) > mappedsize)
+		return 0;
+	names = (const uint32_t *)((const struct indexdir *)(h + 1) + h->ndirs) + h->nentries;
+	for (i = 0; i < h->nnames; i++)
+		if (names[i] < mappedsize)
+			additem(mapped + names[i]);
+	return 1;
+}
+
+/* map a regular file, the items then point into the mapping */
+static int
+mapitems(int fd)
+{
+	struct stat st;
+	off_t off;
+	char *p, *nl, *end;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    (off = lseek(fd, 0, SEEK_CUR)) == -1 || off >= st.st_size)
+		return 0;
+	/* private and writable, so the newlines can become terminators */
+	if ((mapped = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+	                   MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		mapped = NULL;
+		return 0;
+	}
+	mappedsize = st.st_size;
+	if (!off && indexitems())
+		return 1;
+	end = mapped + st.st_size;
+	for (p = mapped + off; (nl = memchr(p, '\n', end - p)); p = nl + 1) {
+		*nl = '\0';
+		additem(p);
+	}
+	/* the mapping has no room for the last terminator */
+	if (p < end) {
+		newarena(end - p + 1);
+		memcpy(arena->buf, p, end - p);
+		arena->buf[end - p] = '\0';
+		additem(arena->buf);
+		partial = arena->len = end - p + 1;
+	}
+	return 1;
+}
+
+static void
+freeitems(void)
+{
+	struct arena *a;
+
+	while ((a = arena)) {
+		arena = a->next;
+		free(a);
+	}
+	partial = 0;
+	if (mapped)
+		munmap(mapped, mappedsize);
+	mapped = NULL;
+	nitems = nmatched = nranked = 0;
+	if (items)
+		items[0].text = NULL;
+	/* the match sets point into the old items */
+	while (nmatchsets)
+		popmatches();
+}
+
 static void
 readstdin(FILE* stream)
 {
-	char *line = NULL;
-	size_t i, itemsiz = 0, linesiz = 0;
-	ssize_t len;
+	int fd = fileno(stream);
 
 	if(passwd){
     inputw = lines = 0;
     return;
   }
 
-	/* read each line from stdin and add it to the item list */
-	for (i = 0; (len = getline(&line, &linesiz, stream)) != -1; i++) {
-		if (i + 1 >= itemsiz) {
-			itemsiz += 256;
-			if (!(items = realloc(items, itemsiz * sizeof(*items))))
-				die("cannot realloc %zu bytes:", itemsiz * sizeof(*items));
-		}
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
-		if (!(items[i].text = strdup(line)))
-			die("strdup:");
+	/* a dynamic command replaces the items of the previous one */
+	freeitems();
+	if (!mapitems(fd))
+		while (readitems(fd))
+			;
+	nmatched = nitems;
+	lines = MIN(max_lines, nitems);
+}
 
-		items[i].out = 0;
+/* add what stdin has for us now, see -a */
+static void
+readstream(void)
+{
+	if (readitems(streamfd) == 0) {
+		close(streamfd);
+		streamfd = -1;
 	}
-	free(line);
-	if (items)
-		items[i].text = NULL;
-	lines = MIN(max_lines, i);
 }
 
 void
@@ -1499,46 +2393,110 @@ load_xresources(void)
 	XCloseDisplay(display);
 }
 
+static void
+handleevent(XEvent *ev)
+{
+	if (XFilterEvent(ev, win))
+		return;
+	switch(ev->type) {
+	case DestroyNotify:
+		if (ev->xdestroywindow.window != win)
+			break;
+		cleanup();
+		exit(1);
+	case ButtonPress:
+		buttonpress(ev);
+		break;
+	case MotionNotify:
+		mousemove(ev);
+		break;
+	case Expose:
+		if (ev->xexpose.count == 0)
+			drw_map(drw, win, 0, 0, mw, mh);
+		break;
+	case FocusIn:
+		/* regrab focus from parent window */
+		if (ev->xfocus.window != win)
+			grabfocus();
+		break;
+	case KeyPress:
+		keypress(&ev->xkey);
+		break;
+	case SelectionNotify:
+		if (ev->xselection.property == utf8)
+			paste();
+		break;
+	case VisibilityNotify:
+		if (ev->xvisibility.state != VisibilityUnobscured)
+			XRaiseWindow(dpy, win);
+		break;
+	}
+}
+
 static void
 run(void)
 {
 	XEvent ev;
-
-	while (!XNextEvent(dpy, &ev)) {
-		if (XFilterEvent(&ev, win))
-			continue;
-		switch(ev.type) {
-		case DestroyNotify:
-			if (ev.xdestroywindow.window != win)
-				break;
-			cleanup();
-			exit(1);
-		case ButtonPress:
-			buttonpress(&ev);
-			break;
-		case MotionNotify:
-			mousemove(&ev);
-			break;
-		case Expose:
-			if (ev.xexpose.count == 0)
-				drw_map(drw, win, 0, 0, mw, mh);
-			break;
-		case FocusIn:
-			/* regrab focus from parent window */
-			if (ev.xfocus.window != win)
-				grabfocus();
-			break;
-		case KeyPress:
-			keypress(&ev.xkey);
-			break;
-		case SelectionNotify:
-			if (ev.xselection.property == utf8)
-				paste();
-			break;
-		case VisibilityNotify:
-			if (ev.xvisibility.state != VisibilityUnobscured)
-				XRaiseWindow(dpy, win);
-			break;
+	struct pollfd pfd[4];
+	struct timespec now, drawn;
+	long elapsed, due;
+	int timeout;
+
+	/* read stdin between events while it lasts, see -a, show images
+	 * as soon as they are decoded and run -dy in the background */
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].events = POLLIN;
+	pfd[2].fd = imagefd;
+	pfd[2].events = POLLIN;
+	pfd[3].events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &drawn);
+	for (;;) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			handleevent(&ev);
+		}
+		pfd[1].fd = streamfd;
+		pfd[3].fd = dynfd;
+		timeout = -1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (nitems > nmatched) {
+			elapsed = (now.tv_sec - drawn.tv_sec) * 1000 +
+			          (now.tv_nsec - drawn.tv_nsec) / 1000000;
+			timeout = MAX((long)streaminterval - elapsed, 0);
+		}
+		if (dynqueued) {
+			due = (dyndue.tv_sec - now.tv_sec) * 1000 +
+			      (dyndue.tv_nsec - now.tv_nsec + 999999) / 1000000;
+			if (timeout == -1 || due < timeout)
+				timeout = MAX(due, 0);
+		}
+		if (poll(pfd, 4, timeout) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("poll:");
+		}
+		if (pfd[1].revents)
+			readstream();
+		if (pfd[2].revents && drw_image_update(drw)) {
+			calcoffsets();
+			drawmenu();
+		}
+		if (pfd[3].revents)
+			readdynamic();
+		dynreap();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (dynqueued && (now.tv_sec > dyndue.tv_sec || (now.tv_sec == dyndue.tv_sec &&
+		    now.tv_nsec >= dyndue.tv_nsec)))
+			dynstart();
+		if (nitems > nmatched) {
+			elapsed = (now.tv_sec - drawn.tv_sec) * 1000 +
+			          (now.tv_nsec - drawn.tv_nsec) / 1000000;
+			if ((streamfd < 0 && dynfd < 0) || elapsed >= (long)streaminterval) {
+				matchnew(nmatched);
+				drawmenu();
+				drawn = now;
+			}
 		}
 	}
 }
@@ -1656,7 +2614,7 @@ setup(void)
 static void
 usage(void)
 {
-	die("usage: dmenu [-bsFfivP] [-vi] [-bw width] [-l lines] [-h height] [-p prompt]\n"
+	die("usage: dmenu [-absFfivP] [-vi] [-bw width] [-l lines] [-h height] [-p prompt]\n"
 	    "             [-fn font] [-m monitor]\n"
 	    "             [-nb color] [-nf color] [-sb color] [-sf color]\n"
       "             [-x xoffset] [-y yoffset] [-z width]\n"
@@ -1668,6 +2626,7 @@ int
 main(int argc, char *argv[])
 {
 	XWindowAttributes wa;
+	struct stat st;
 	int i, fast = 0;
 
 	XrmInitialize();
@@ -1684,6 +2643,8 @@ main(int argc, char *argv[])
 			fuzzy = 0;
 		else if (!strcmp(argv[i], "-f"))   /* grabs keyboard before reading stdin */
 			fast = 1;
+		else if (!strcmp(argv[i], "-a"))   /* reads stdin while the menu is shown */
+			streaming = 1;
 		else if (!strcmp(argv[i], "-i")) { /* case-insensitive item matching */
 			fstrncmp = strncasecmp;
 			fstrstr = cistrstr;
@@ -1762,6 +2723,7 @@ main(int argc, char *argv[])
 		    parentwin);
 	xinitvisual();
 	drw = drw_create(dpy, screen, root, wa.width, wa.height, visual, depth, cmap);
+	imagefd = drw_image_init(drw, (size_t)imagecache << 20, imagethreads);
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
@@ -1775,7 +2737,13 @@ main(int argc, char *argv[])
 	loadhistory();
 
 	max_lines = lines;
-	if (fast && !isatty(0)) {
+	/* a regular file, like the index of dmenu_run, is mapped at once */
+	if (streaming && !dynamic && !passwd &&
+	    (fstat(STDIN_FILENO, &st) == -1 || !S_ISREG(st.st_mode))) {
+		/* items are read in run(), the menu shows up right away */
+		streamfd = STDIN_FILENO;
+		grabkeyboard();
+	} else if (fast && !isatty(0)) {
 		grabkeyboard();
 		if (!dynamic)
 			readstdin(stdin);
@@ -1,7 +1,11 @@
 /* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
 #include <spng.h>
@@ -11,16 +15,37 @@
 
 #define UTF_INVALID 0xFFFD
 
+enum { ImgIdle, ImgPending, ImgReady, ImgError }; /* image states */
+
 struct image_item {
-	const char *path;
-	int width;
-	int height;
-	char *buf;
+	char *path;
+	unsigned int width;  /* cropped size, known from the header */
+	unsigned int height;
+	int state;           /* only changed by the drawing thread */
+	char *buf;           /* BGRA pixels handed over by a decoder */
 	Pixmap pixmap;
-	struct image_item *next;
+	unsigned long used;  /* frame it was last drawn in */
+	struct image_item *next;  /* hash chain */
+	struct image_item *job;   /* decode queue or finished list */
+	struct image_item *older, *newer; /* uploaded pixmaps, LRU order */
 };
 
-static struct image_item *images = NULL;
+static struct image_item **imgtab = NULL;
+static unsigned int imgtabsize, nimages;
+static struct image_item *lru, *mru;
+static size_t imgbytes, imgbudget = 64 << 20;
+static unsigned long imgframe = 1;
+static unsigned int imgthreads, nimgworkers;
+static struct image_item *jobs, *finished;
+static pthread_mutex_t imglock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t imgcond = PTHREAD_COND_INITIALIZER;
+static int imgpipe[2] = { -1, -1 };
+
+struct advance {
+	unsigned int cp; /* codepoint + 1, 0 for a free slot */
+	unsigned int w;
+	int exists;
+};
 
 static int
 utf8decode(const char *s_in, long *u, int *err)
@@ -151,9 +176,54 @@ xfont_free(Fnt *font)
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
+	free(font->adv);
 	free(font);
 }
 
+static struct advance *
+xfont_advslot(Fnt *font, unsigned int cp)
+{
+	unsigned int i;
+
+	for (i = cp * 2654435761u; ; i++) {
+		i &= font->advcap - 1;
+		if (!font->adv[i].cp || font->adv[i].cp == cp)
+			return &font->adv[i];
+	}
+}
+
+/*
+ * Return the advance of codepoint cp, encoded as text[0..len), and in
+ * *exists whether font has it. Both are remembered per font, so laying
+ * out text costs no Xft calls once its characters were seen.
+ */
+static unsigned int
+xfont_advance(Fnt *font, long cp, const char *text, unsigned int len, int *exists)
+{
+	struct advance *a, *old = font->adv;
+	unsigned int i, oldcap = font->advcap;
+
+	/* keep the load under 3/4 */
+	if (4 * (font->nadv + 1) > 3 * font->advcap) {
+		font->advcap = font->advcap ? font->advcap * 2 : 256;
+		font->adv = ecalloc(font->advcap, sizeof(*font->adv));
+		for (i = 0; i < oldcap; i++)
+			if (old[i].cp)
+				*xfont_advslot(font, old[i].cp) = old[i];
+		free(old);
+	}
+
+	a = xfont_advslot(font, cp + 1);
+	if (!a->cp) {
+		a->cp = cp + 1;
+		a->exists = XftCharExists(font->dpy, font->xfont, cp);
+		drw_font_getexts(font, text, len, &a->w, NULL);
+		font->nadv++;
+	}
+	*exists = a->exists;
+	return a->w;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -251,7 +321,7 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	FcPattern *fcpattern;
 	FcPattern *match;
 	XftResult result;
-	int charexists = 0, overflow = 0;
+	int charexists = 0, exists, overflow = 0;
 	/* keep track of a couple codepoints for which we have no match. */
 	static unsigned int nomatches[128], ellipsis_width, invalid_width;
 	static const char invalid[] = "�";
@@ -283,9 +353,16 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, &utf8err);
 			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
+				/* invalid sequences are measured as they are */
+				if (utf8err) {
+					exists = XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
 					drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
+				} else {
+					tmpw = xfont_advance(curfont, utf8codepoint, text,
+					                     utf8charlen, &exists);
+				}
+				charexists = charexists || exists;
+				if (charexists) {
 					if (ew + ellipsis_width <= w) {
 						/* keep track where the ellipsis still fits */
 						ellipsis_x = x + ew;
@@ -396,35 +473,21 @@ no_match:
 	return x + (render ? w : 0);
 }
 
-static struct image_item *
-load_image(Drw *drw, unsigned int maxw, unsigned int maxh, const char *path)
+static spng_ctx *
+image_open(const char *path, FILE **png, struct spng_ihdr *ihdr)
 {
-	FILE *png;
-	spng_ctx *ctx = NULL;
-	int ret = 0;
-	struct spng_ihdr ihdr;
-	struct spng_plte plte = {0};
-	struct spng_row_info row_info = {0};
-	char *spng_buf;
-	int fmt = SPNG_FMT_RGBA8;
-	int crop_width;
-	int crop_height;
-
-	struct image_item *image = ecalloc(1, sizeof(struct image_item));
-	image->path = path;
-	image->next = images;
-	images = image;
+	spng_ctx *ctx;
+	int ret;
 
-	png = fopen(path, "rb");
-	if (png == NULL) {
+	if (!(*png = fopen(path, "rb"))) {
 		fprintf(stderr, "error opening input file %s\n", path);
 		return NULL;
 	}
 
 	/* Create a context */
-	ctx = spng_ctx_new(0);
-	if (ctx == NULL) {
+	if (!(ctx = spng_ctx_new(0))) {
 		fprintf(stderr, "%s: spng_ctx_new() failed\n", path);
+		fclose(*png);
 		return NULL;
 	}
 
@@ -436,93 +499,321 @@ load_image(Drw *drw, unsigned int maxw, unsigned int maxh, const char *path)
 	size_t limit = 1024 * 1024 * 64;
 	spng_set_chunk_limits(ctx, limit, limit);
 
-	spng_set_png_file(ctx, png);
+	spng_set_png_file(ctx, *png);
 
-	ret = spng_get_ihdr(ctx, &ihdr);
+	ret = spng_get_ihdr(ctx, ihdr);
 	if (ret) {
 		fprintf(stderr, "%s: spng_get_ihdr() error: %s\n", path, spng_strerror(ret));
+		spng_ctx_free(ctx);
+		fclose(*png);
 		return NULL;
 	}
+	return ctx;
+}
+
+/* decode the top left width x height pixels of path as BGRA, the rows
+ * below are not decoded unless the image is interlaced */
+static char *
+image_decode(const char *path, unsigned int width, unsigned int height)
+{
+	FILE *png;
+	spng_ctx *ctx;
+	int ret;
+	struct spng_ihdr ihdr;
+	struct spng_plte plte = {0};
+	struct spng_row_info row_info = {0};
+	char *rows = NULL, *scratch = NULL, *buf = NULL, *row;
+	int fmt = SPNG_FMT_RGBA8;
+	size_t image_size, bytes_per_row; /* size in bytes, not in pixels */
+	unsigned int i, j;
+
+	if (!(ctx = image_open(path, &png, &ihdr)))
+		return NULL;
 
 	ret = spng_get_plte(ctx, &plte);
 	if (ret && ret != SPNG_ECHUNKAVAIL) {
 		fprintf(stderr, "%s: spng_get_plte() error: %s\n", path, spng_strerror(ret));
-		return NULL;
+		goto out;
 	}
 
-	size_t image_size, bytes_per_row; /* size in bytes, not in pixels */
-
-	ret = spng_decoded_image_size(ctx, fmt, &image_size);
-	if (ret)
-		return NULL;
-
-	spng_buf = malloc(image_size);
-	if (!spng_buf)
-		return NULL;
+	if (spng_decoded_image_size(ctx, fmt, &image_size))
+		goto out;
+	/* ihdr.height will always be non-zero if spng_get_ihdr() succeeds */
+	bytes_per_row = image_size / ihdr.height;
+	height = MIN(height, ihdr.height);
+	width = MIN(width, ihdr.width);
 
 	ret = spng_decode_image(ctx, NULL, 0, fmt, SPNG_DECODE_PROGRESSIVE);
 	if (ret) {
 		fprintf(stderr, "%s: progressive spng_decode_image() error: %s\n",
 		        path, spng_strerror(ret));
-		return NULL;
+		goto out;
 	}
 
-	/* ihdr.height will always be non-zero if spng_get_ihdr() succeeds */
-	bytes_per_row = image_size / ihdr.height;
-	crop_width = MIN(ihdr.width, maxw);
-	crop_height = MIN(ihdr.height, maxh);
-
+	/* only the cropped rows are kept, interlaced passes past them
+	 * are decoded into a scratch row */
+	if (!(rows = calloc(height, bytes_per_row)) || !(scratch = malloc(bytes_per_row)))
+		goto out;
 	do {
 		ret = spng_get_row_info(ctx, &row_info);
 		if (ret)
 			break;
-		ret = spng_decode_row(ctx, spng_buf + row_info.row_num * bytes_per_row, bytes_per_row);
-	} while (!ret && row_info.row_num < crop_height);
+		row = row_info.row_num < height ? rows + row_info.row_num * bytes_per_row : scratch;
+		ret = spng_decode_row(ctx, row, bytes_per_row);
+	} while (!ret && (ihdr.interlace_method || row_info.row_num + 1 < height));
 
-	if (ret != SPNG_EOI && row_info.row_num < crop_height)
+	if (ret && ret != SPNG_EOI)
 		fprintf(stderr, "%s: progressive decode error: %s\n", path, spng_strerror(ret));
 
-	image->buf = calloc(ihdr.width * crop_height * 4, sizeof(char));
-	for (int i = 0; i < ihdr.width * crop_height; i++) {
-		/* RGBA to BGRA */
-		image->buf[i*4+2] = spng_buf[i*4+0];
-		image->buf[i*4+1] = spng_buf[i*4+1];
-		image->buf[i*4+0] = spng_buf[i*4+2];
-		image->buf[i*4+3] = spng_buf[i*4+3];
+	if (!(buf = malloc((size_t)width * height * 4)))
+		goto out;
+	for (i = 0; i < height; i++) {
+		row = rows + i * bytes_per_row;
+		for (j = 0; j < width; j++) {
+			/* RGBA to BGRA */
+			buf[(i*width+j)*4+2] = row[j*4+0];
+			buf[(i*width+j)*4+1] = row[j*4+1];
+			buf[(i*width+j)*4+0] = row[j*4+2];
+			buf[(i*width+j)*4+3] = row[j*4+3];
+		}
 	}
-	image->width = crop_width;
-	image->height = crop_height;
-
-	XImage *img = XCreateImage(drw->dpy, CopyFromParent, DefaultDepth(drw->dpy, drw->screen),
-	                           ZPixmap, 0, image->buf, ihdr.width, crop_height, 32, 0);
-	image->pixmap = XCreatePixmap(drw->dpy, drw->root, crop_width, crop_height, 24);
-	XPutImage(drw->dpy, image->pixmap, drw->gc, img, 0, 0, 0, 0, crop_width, crop_height);
+out:
+	free(rows);
+	free(scratch);
 	spng_ctx_free(ctx);
 	fclose(png);
+	return buf;
+}
+
+static void *
+image_worker(void *arg)
+{
+	struct image_item *image;
+	char *buf;
+
+	for (;;) {
+		pthread_mutex_lock(&imglock);
+		while (!jobs)
+			pthread_cond_wait(&imgcond, &imglock);
+		image = jobs;
+		jobs = image->job;
+		pthread_mutex_unlock(&imglock);
+
+		buf = image_decode(image->path, image->width, image->height);
+
+		pthread_mutex_lock(&imglock);
+		image->buf = buf;
+		image->job = finished;
+		finished = image;
+		pthread_mutex_unlock(&imglock);
+		while (write(imgpipe[1], "", 1) == -1 && errno == EINTR)
+			;
+	}
+	return NULL;
+}
+
+static unsigned int
+image_hash(const char *path)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *path; path++)
+		h = (h ^ (unsigned char)*path) * 16777619u;
+	return h;
+}
+
+static void
+image_unlink(struct image_item *image)
+{
+	if (image->older)
+		image->older->newer = image->newer;
+	else
+		lru = image->newer;
+	if (image->newer)
+		image->newer->older = image->older;
+	else
+		mru = image->older;
+	image->older = image->newer = NULL;
+}
+
+static void
+image_touch(struct image_item *image)
+{
+	if (image == mru)
+		return;
+	if (image->older || image == lru)
+		image_unlink(image);
+	image->older = mru;
+	if (mru)
+		mru->newer = image;
+	else
+		lru = image;
+	mru = image;
+}
+
+/* drop the least recently drawn pixmaps over the budget, but none shown
+ * in the last frame */
+static void
+image_evict(Drw *drw)
+{
+	struct image_item *image;
+
+	while (imgbytes > imgbudget && (image = lru) && image->used + 1 < imgframe) {
+		image_unlink(image);
+		XFreePixmap(drw->dpy, image->pixmap);
+		image->pixmap = None;
+		imgbytes -= (size_t)image->width * image->height * 4;
+		image->state = ImgIdle;
+	}
+}
+
+static void
+image_upload(Drw *drw, struct image_item *image)
+{
+	XImage *img;
+
+	if (!image->buf) {
+		image->state = ImgError;
+		image->width = image->height = 0;
+		return;
+	}
+	img = XCreateImage(drw->dpy, CopyFromParent, DefaultDepth(drw->dpy, drw->screen),
+	                   ZPixmap, 0, image->buf, image->width, image->height, 32, 0);
+	image->pixmap = XCreatePixmap(drw->dpy, drw->root, image->width, image->height, 24);
+	XPutImage(drw->dpy, image->pixmap, drw->gc, img, 0, 0, 0, 0, image->width, image->height);
+	XDestroyImage(img); /* frees image->buf */
+	image->buf = NULL;
+	image->state = ImgReady;
+	image->used = imgframe;
+	imgbytes += (size_t)image->width * image->height * 4;
+	image_touch(image);
+}
+
+static void
+image_queue(Drw *drw, struct image_item *image)
+{
+	pthread_t tid;
+
+	if (image->state != ImgIdle)
+		return;
+	if (!imgthreads || imgpipe[1] < 0) {
+		image->buf = image_decode(image->path, image->width, image->height);
+		image_upload(drw, image);
+		image_evict(drw);
+		return;
+	}
+	image->state = ImgPending;
+	pthread_mutex_lock(&imglock);
+	/* the last requested image is decoded first */
+	image->job = jobs;
+	jobs = image;
+	if (nimgworkers < imgthreads && !pthread_create(&tid, NULL, image_worker, NULL)) {
+		pthread_detach(tid);
+		nimgworkers++;
+	}
+	pthread_cond_signal(&imgcond);
+	pthread_mutex_unlock(&imglock);
+}
+
+/* find path in images, reading the size from its header when it is new */
+static struct image_item *
+image_get(const char *path, unsigned int maxw, unsigned int maxh)
+{
+	struct image_item *image, **tab;
+	struct spng_ihdr ihdr;
+	spng_ctx *ctx;
+	FILE *png;
+	unsigned int i, h = image_hash(path);
+
+	if (imgtabsize)
+		for (image = imgtab[h & (imgtabsize - 1)]; image; image = image->next)
+			if (!strcmp(image->path, path))
+				return image;
+
+	if (nimages >= imgtabsize) {
+		i = imgtabsize ? imgtabsize * 2 : 256;
+		tab = ecalloc(i, sizeof(*tab));
+		while (imgtabsize--)
+			while ((image = imgtab[imgtabsize])) {
+				imgtab[imgtabsize] = image->next;
+				image->next = tab[image_hash(image->path) & (i - 1)];
+				tab[image_hash(image->path) & (i - 1)] = image;
+			}
+		free(imgtab);
+		imgtab = tab;
+		imgtabsize = i;
+	}
+	image = ecalloc(1, sizeof(struct image_item));
+	if (!(image->path = strdup(path)))
+		die("strdup:");
+	if ((ctx = image_open(path, &png, &ihdr))) {
+		image->width = MIN(ihdr.width, maxw);
+		image->height = MIN(ihdr.height, maxh);
+		spng_ctx_free(ctx);
+		fclose(png);
+	}
+	image->state = image->width && image->height ? ImgIdle : ImgError;
+	image->next = imgtab[h & (imgtabsize - 1)];
+	imgtab[h & (imgtabsize - 1)] = image;
+	nimages++;
 	return image;
 }
 
+int
+drw_image_init(Drw *drw, size_t budget, unsigned int threads)
+{
+	imgbudget = budget;
+	imgthreads = threads;
+	if (threads && imgpipe[0] < 0) {
+		if (pipe(imgpipe) == -1)
+			die("pipe:");
+		fcntl(imgpipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(imgpipe[0], F_SETFD, FD_CLOEXEC);
+		fcntl(imgpipe[1], F_SETFD, FD_CLOEXEC);
+	}
+	return imgpipe[0];
+}
+
+int
+drw_image_update(Drw *drw)
+{
+	struct image_item *image, *done;
+	char tmp[64];
+	int n = 0;
+
+	while (read(imgpipe[0], tmp, sizeof(tmp)) > 0)
+		;
+	pthread_mutex_lock(&imglock);
+	done = finished;
+	finished = NULL;
+	pthread_mutex_unlock(&imglock);
+	for (; (image = done); n++) {
+		done = image->job;
+		image_upload(drw, image);
+	}
+	image_evict(drw);
+	return n;
+}
+
+void
+drw_image_prefetch(Drw *drw, const char *path, unsigned int maxw, unsigned int maxh)
+{
+	if (drw && path && maxw && maxh)
+		image_queue(drw, image_get(path, maxw, maxh));
+}
+
 void
 drw_image(Drw *drw, int *x, int *y, unsigned int *w, unsigned int *h,
           unsigned int lrpad, unsigned int tbpad, const char *path, int vertical)
 {
 	/* *x and *y refer to box position including padding,
 	 * *w and *h are the maximum image width and height without padding */
-	struct image_item *image = NULL;
+	struct image_item *image;
 	int render = *x || *y;
 	int crop_width, crop_height;
 
-	// find path in images
-	for (struct image_item *item = images; item != NULL; item = item->next) {
-		if (!strcmp(item->path, path)) {
-			image = item;
-			if (!image->buf)
-				goto file_error;
-			break;
-		}
-	}
-
-	if (!image && !(image = load_image(drw, *w, *h, path)))
+	image = image_get(path, *w, *h);
+	if (image->state == ImgError)
 		goto file_error;
 
 	if (!render) {
@@ -538,10 +829,17 @@ drw_image(Drw *drw, int *x, int *y, unsigned int *w, unsigned int *h,
 	else
 		*w = crop_width;
 
+	/* the background stands in for the image until it is decoded */
 	XSetForeground(drw->dpy, drw->gc, drw->scheme[ColBg].pixel);
 	XFillRectangle(drw->dpy, drw->drawable, drw->gc, *x, *y, *w + lrpad, *h + tbpad);
-	XCopyArea(drw->dpy, image->pixmap, drw->drawable, drw->gc, 0, 0,
-	          crop_width, crop_height, *x + lrpad/2, *y + tbpad/2);
+	if (image->state == ImgReady) {
+		XCopyArea(drw->dpy, image->pixmap, drw->drawable, drw->gc, 0, 0,
+		          crop_width, crop_height, *x + lrpad/2, *y + tbpad/2);
+		image->used = imgframe;
+		image_touch(image);
+	} else {
+		image_queue(drw, image);
+	}
 
 	if (vertical)
 		*y += *h + tbpad;
@@ -561,6 +859,7 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
 	XSync(drw->dpy, False);
+	imgframe++;
 }
 
 unsigned int
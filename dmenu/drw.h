@@ -10,6 +10,8 @@ typedef struct Fnt {
 	XftFont *xfont;
 	FcPattern *pattern;
 	struct Fnt *next;
+	struct advance *adv; /* codepoint advances, see xfont_advance() */
+	unsigned int nadv, advcap;
 } Fnt;
 
 enum { ColFg, ColBg }; /* Clr scheme index */
@@ -44,6 +46,9 @@ void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned in
 /* Image abstraction */
 unsigned int drw_getimagewidth_clamp(Drw *drw, const char *path, unsigned int maxw, unsigned int maxh);
 unsigned int drw_getimageheight_clamp(Drw *drw, const char *path, unsigned int maxw, unsigned int maxh);
+int drw_image_init(Drw *drw, size_t budget, unsigned int threads);
+int drw_image_update(Drw *drw);
+void drw_image_prefetch(Drw *drw, const char *path, unsigned int maxw, unsigned int maxh);
 
 /* Colorscheme abstraction */
 void drw_clr_create(Drw *drw, Clr *dest, const char *clrname, unsigned int alpha);
@@ -0,0 +1,26 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Executable index kept by stest -i and read by dmenu from stdin. Offsets
+ * count from the start of the file and every string is NUL-terminated, so
+ * the names are used straight from a mapping.
+ */
+#define INDEXMAGIC "dmenuix1"
+
+struct indexhdr {
+	char magic[8];
+	uint32_t flags;    /* stest tests the entries passed */
+	uint32_t ndirs;
+	uint32_t nentries; /* names of each directory, in directory order */
+	uint32_t nnames;   /* all names sorted, without duplicates */
+};
+
+struct indexdir {
+	int64_t sec, nsec; /* mtime of the directory when it was read */
+	uint32_t path;
+	uint32_t first, n; /* its names among the entries */
+	uint32_t pad;
+};
+
+/* followed by uint32_t entries[nentries], uint32_t names[nnames] and the
+ * strings they point to */
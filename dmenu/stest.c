@@ -1,58 +1,324 @@
 /* See LICENSE file for copyright and license details. */
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "arg.h"
+#include "index.h"
 char *argv0;
 
 #define FLAG(x)  (flag[(x)-'a'])
 
-static void test(const char *, const char *);
+static void found(const char *);
+static int test(int, const char *, const char *);
 static void usage(void);
 
 static int match = 0;
 static int flag[26];
 static struct stat old, new;
+static char *indexfile = NULL;
+
+/* the previous index, see -i */
+static char *oldindex = NULL;
+static size_t oldsize;
+
+/* the new index, its offsets are relative to strs until it is written */
+static char *strs = NULL;
+static size_t strslen, strscap;
+static uint32_t *ents = NULL;
+static size_t nents, entscap;
 
 static void
-test(const char *path, const char *name)
+found(const char *name)
+{
+	if (FLAG('q'))
+		exit(0);
+	match = 1;
+	puts(name);
+}
+
+/* test path, relative to the directory dfd */
+static int
+test(int dfd, const char *path, const char *name)
 {
 	struct stat st, ln;
 
-	if ((!stat(path, &st) && (FLAG('a') || name[0] != '.')        /* hidden files      */
-	&& (!FLAG('b') || S_ISBLK(st.st_mode))                        /* block special     */
-	&& (!FLAG('c') || S_ISCHR(st.st_mode))                        /* character special */
-	&& (!FLAG('d') || S_ISDIR(st.st_mode))                        /* directory         */
-	&& (!FLAG('e') || access(path, F_OK) == 0)                    /* exists            */
-	&& (!FLAG('f') || S_ISREG(st.st_mode))                        /* regular file      */
-	&& (!FLAG('g') || st.st_mode & S_ISGID)                       /* set-group-id flag */
-	&& (!FLAG('h') || (!lstat(path, &ln) && S_ISLNK(ln.st_mode))) /* symbolic link     */
-	&& (!FLAG('n') || st.st_mtime > new.st_mtime)                 /* newer than file   */
-	&& (!FLAG('o') || st.st_mtime < old.st_mtime)                 /* older than file   */
-	&& (!FLAG('p') || S_ISFIFO(st.st_mode))                       /* named pipe        */
-	&& (!FLAG('r') || access(path, R_OK) == 0)                    /* readable          */
-	&& (!FLAG('s') || st.st_size > 0)                             /* not empty         */
-	&& (!FLAG('u') || st.st_mode & S_ISUID)                       /* set-user-id flag  */
-	&& (!FLAG('w') || access(path, W_OK) == 0)                    /* writable          */
-	&& (!FLAG('x') || access(path, X_OK) == 0)) != FLAG('v')) {   /* executable        */
-		if (FLAG('q'))
-			exit(0);
-		match = 1;
-		puts(name);
+	return ((FLAG('a') || name[0] != '.')                                          /* hidden files      */
+	&& !fstatat(dfd, path, &st, 0)
+	&& (!FLAG('b') || S_ISBLK(st.st_mode))                                         /* block special     */
+	&& (!FLAG('c') || S_ISCHR(st.st_mode))                                         /* character special */
+	&& (!FLAG('d') || S_ISDIR(st.st_mode))                                         /* directory         */
+	&& (!FLAG('e') || faccessat(dfd, path, F_OK, 0) == 0)                          /* exists            */
+	&& (!FLAG('f') || S_ISREG(st.st_mode))                                         /* regular file      */
+	&& (!FLAG('g') || st.st_mode & S_ISGID)                                        /* set-group-id flag */
+	&& (!FLAG('h') || (!fstatat(dfd, path, &ln, AT_SYMLINK_NOFOLLOW)
+	                   && S_ISLNK(ln.st_mode)))                                    /* symbolic link     */
+	&& (!FLAG('n') || st.st_mtime > new.st_mtime)                                  /* newer than file   */
+	&& (!FLAG('o') || st.st_mtime < old.st_mtime)                                  /* older than file   */
+	&& (!FLAG('p') || S_ISFIFO(st.st_mode))                                        /* named pipe        */
+	&& (!FLAG('r') || faccessat(dfd, path, R_OK, 0) == 0)                          /* readable          */
+	&& (!FLAG('s') || st.st_size > 0)                                              /* not empty         */
+	&& (!FLAG('u') || st.st_mode & S_ISUID)                                        /* set-user-id flag  */
+	&& (!FLAG('w') || faccessat(dfd, path, W_OK, 0) == 0)                          /* writable          */
+	&& (!FLAG('x') || faccessat(dfd, path, X_OK, 0) == 0)) != FLAG('v');           /* executable        */
+}
+
+static void *
+erealloc(void *p, size_t size)
+{
+	if (!(p = realloc(p, size))) {
+		perror("realloc");
+		exit(2);
+	}
+	return p;
+}
+
+static uint32_t
+addstr(const char *s)
+{
+	size_t n = strlen(s) + 1, off = strslen;
+
+	if (strslen + n > strscap) {
+		strscap = strscap * 2 > strslen + n ? strscap * 2 : strslen + n + 65536;
+		strs = erealloc(strs, strscap);
+	}
+	memcpy(strs + strslen, s, n);
+	strslen += n;
+	return off;
+}
+
+static void
+addent(uint32_t off)
+{
+	if (nents == entscap) {
+		entscap = entscap ? entscap * 2 : 4096;
+		ents = erealloc(ents, entscap * sizeof *ents);
 	}
+	ents[nents++] = off;
+}
+
+static int
+cmpent(const void *a, const void *b)
+{
+	return strcmp(strs + *(const uint32_t *)a, strs + *(const uint32_t *)b);
+}
+
+/* the tests an index was made with, -q and -i itself don't matter */
+static uint32_t
+indexflags(void)
+{
+	uint32_t f = 0;
+	int i;
+
+	for (i = 0; i < 26; i++)
+		if (flag[i] && i != 'q' - 'a')
+			f |= 1u << i;
+	return f;
+}
+
+static void
+loadindex(void)
+{
+	const struct indexhdr *h;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(indexfile, O_RDONLY)) == -1)
+		return;
+	if (!fstat(fd, &st) && st.st_size > (off_t)sizeof *h &&
+	    (oldindex = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+		oldsize = st.st_size;
+		h = (const struct indexhdr *)oldindex;
+		/* a stale or foreign index is rebuilt from scratch */
+		if (memcmp(h->magic, INDEXMAGIC, sizeof h->magic) || h->flags != indexflags() ||
+		    FLAG('n') || FLAG('o') || oldindex[oldsize - 1] != '\0' ||
+		    sizeof *h + (uint64_t)h->ndirs * sizeof(struct indexdir) +
+		    ((uint64_t)h->nentries + h->nnames) * sizeof(uint32_t) > oldsize) {
+			munmap(oldindex, oldsize);
+			oldindex = NULL;
+		}
+	} else {
+		oldindex = NULL;
+	}
+	close(fd);
+}
+
+/* add the names of the previous index if dir has not changed since */
+static int
+reusedir(const char *dir, const struct stat *st)
+{
+	const struct indexhdr *h = (const struct indexhdr *)oldindex;
+	const struct indexdir *d;
+	const uint32_t *e;
+	uint32_t i, j;
+
+	if (!oldindex)
+		return 0;
+	d = (const struct indexdir *)(h + 1);
+	e = (const uint32_t *)(d + h->ndirs);
+	for (i = 0; i < h->ndirs; i++, d++) {
+		if (d->path >= oldsize || strcmp(oldindex + d->path, dir))
+			continue;
+		if (d->sec != st->st_mtim.tv_sec || d->nsec != st->st_mtim.tv_nsec ||
+		    (uint64_t)d->first + d->n > h->nentries)
+			return 0;
+		for (j = d->first; j < d->first + d->n; j++)
+			if (e[j] < oldsize)
+				addent(addstr(oldindex + e[j]));
+		return 1;
+	}
+	return 0;
+}
+
+/* whether the previous index was made from dirs as they are now */
+static int
+indexcurrent(char *dirs[], int ndirs)
+{
+	const struct indexhdr *h = (const struct indexhdr *)oldindex;
+	const struct indexdir *d;
+	struct stat st;
+	int i;
+
+	if (!oldindex || h->ndirs != (uint32_t)ndirs)
+		return 0;
+	d = (const struct indexdir *)(h + 1);
+	for (i = 0; i < ndirs; i++, d++) {
+		if (d->path >= oldsize || strcmp(oldindex + d->path, dirs[i]))
+			return 0;
+		if (stat(dirs[i], &st) || !S_ISDIR(st.st_mode)) {
+			if (d->sec != -1 || d->nsec != -1)
+				return 0;
+		} else if (d->sec != st.st_mtim.tv_sec || d->nsec != st.st_mtim.tv_nsec) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* print the names of the previous index */
+static void
+printindex(void)
+{
+	const struct indexhdr *h = (const struct indexhdr *)oldindex;
+	const uint32_t *names;
+	uint32_t i;
+
+	names = (const uint32_t *)((const struct indexdir *)(h + 1) + h->ndirs) + h->nentries;
+	if (!FLAG('q'))
+		for (i = 0; i < h->nnames; i++)
+			if (names[i] < oldsize)
+				puts(oldindex + names[i]);
+	match = h->nnames > 0;
+}
+
+/*
+ * Write the names in the directories dirs that pass the tests to
+ * indexfile and print them. Directories whose mtime is unchanged since
+ * the last run are not read again, and if none has changed the index is
+ * left as it is.
+ */
+static void
+writeindex(char *dirs[], int ndirs)
+{
+	struct indexhdr h = { INDEXMAGIC };
+	struct indexdir *d;
+	struct dirent *de;
+	struct stat st;
+	uint32_t *names, base;
+	size_t i, nnames;
+	char tmp[PATH_MAX];
+	DIR *dir;
+	FILE *fp;
+	int fd;
+
+	loadindex();
+	if (indexcurrent(dirs, ndirs)) {
+		printindex();
+		return;
+	}
+	d = calloc(ndirs ? ndirs : 1, sizeof *d);
+	if (!d) {
+		perror("calloc");
+		exit(2);
+	}
+	addstr(""); /* the last byte of an index is always a terminator */
+	for (i = 0; i < (size_t)ndirs; i++) {
+		d[i].path = addstr(dirs[i]);
+		d[i].first = nents;
+		d[i].sec = d[i].nsec = -1;
+		if (stat(dirs[i], &st) || !S_ISDIR(st.st_mode))
+			continue;
+		d[i].sec = st.st_mtim.tv_sec;
+		d[i].nsec = st.st_mtim.tv_nsec;
+		if (!reusedir(dirs[i], &st) && (dir = opendir(dirs[i]))) {
+			while ((de = readdir(dir)))
+				if (test(dirfd(dir), de->d_name, de->d_name))
+					addent(addstr(de->d_name));
+			closedir(dir);
+		}
+		d[i].n = nents - d[i].first;
+	}
+
+	names = erealloc(NULL, (nents ? nents : 1) * sizeof *names);
+	memcpy(names, ents, nents * sizeof *names);
+	qsort(names, nents, sizeof *names, cmpent);
+	for (i = nnames = 0; i < nents; i++)
+		if (!nnames || strcmp(strs + names[nnames - 1], strs + names[i]))
+			names[nnames++] = names[i];
+
+	/* make the offsets absolute */
+	if (sizeof h + ndirs * sizeof *d + (nents + nnames) * sizeof *names + strslen > UINT32_MAX) {
+		fprintf(stderr, "%s: index too large\n", indexfile);
+		exit(2);
+	}
+	base = sizeof h + ndirs * sizeof *d + (nents + nnames) * sizeof *names;
+	for (i = 0; i < (size_t)ndirs; i++)
+		d[i].path += base;
+	for (i = 0; i < nents; i++)
+		ents[i] += base;
+	for (i = 0; i < nnames; i++)
+		names[i] += base;
+	h.flags = indexflags();
+	h.ndirs = ndirs;
+	h.nentries = nents;
+	h.nnames = nnames;
+
+	/* replace the index at once, dmenu may have the old one mapped */
+	if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", indexfile) >= (int)sizeof tmp ||
+	    (fd = mkstemp(tmp)) == -1 || !(fp = fdopen(fd, "w"))) {
+		perror(indexfile);
+		exit(2);
+	}
+	fwrite(&h, sizeof h, 1, fp);
+	fwrite(d, sizeof *d, ndirs, fp);
+	fwrite(ents, sizeof *ents, nents, fp);
+	fwrite(names, sizeof *names, nnames, fp);
+	fwrite(strs, 1, strslen, fp);
+	if (fclose(fp) == EOF || rename(tmp, indexfile) == -1) {
+		perror(indexfile);
+		unlink(tmp);
+		exit(2);
+	}
+
+	if (!FLAG('q'))
+		for (i = 0; i < nnames; i++)
+			puts(strs + names[i] - base);
+	match = nnames > 0;
 }
 
 static void
 usage(void)
 {
 	fprintf(stderr, "usage: %s [-abcdefghlpqrsuvwx] "
-	        "[-n file] [-o file] [file...]\n", argv0);
+	        "[-i index] [-n file] [-o file] [file...]\n", argv0);
 	exit(2); /* like test(1) return > 1 on error */
 }
 
@@ -60,13 +326,15 @@ int
 main(int argc, char *argv[])
 {
 	struct dirent *d;
-	char path[PATH_MAX], *line = NULL, *file;
+	char *line = NULL, *file;
 	size_t linesiz = 0;
 	ssize_t n;
 	DIR *dir;
-	int r;
 
 	ARGBEGIN {
+	case 'i': /* keep an index of directory contents */
+		indexfile = EARGF(usage());
+		break;
 	case 'n': /* newer than file */
 	case 'o': /* older than file */
 		file = EARGF(usage());
@@ -81,27 +349,27 @@ main(int argc, char *argv[])
 			usage(); /* unknown flag */
 	} ARGEND;
 
-	if (!argc) {
+	if (indexfile) {
+		writeindex(argv, argc);
+	} else if (!argc) {
 		/* read list from stdin */
 		while ((n = getline(&line, &linesiz, stdin)) > 0) {
 			if (line[n - 1] == '\n')
 				line[n - 1] = '\0';
-			test(line, line);
+			if (test(AT_FDCWD, line, line))
+				found(line);
 		}
 		free(line);
 	} else {
 		for (; argc; argc--, argv++) {
 			if (FLAG('l') && (dir = opendir(*argv))) {
 				/* test directory contents */
-				while ((d = readdir(dir))) {
-					r = snprintf(path, sizeof path, "%s/%s",
-					             *argv, d->d_name);
-					if (r >= 0 && (size_t)r < sizeof path)
-						test(path, d->d_name);
-				}
+				while ((d = readdir(dir)))
+					if (test(dirfd(dir), d->d_name, d->d_name))
+						found(d->d_name);
 				closedir(dir);
-			} else {
-				test(*argv, *argv);
+			} else if (test(AT_FDCWD, *argv, *argv)) {
+				found(*argv);
 			}
 		}
 	}
@@ -117,6 +117,7 @@ struct Client {
 	int oldx, oldy, oldw, oldh;
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh, hintsvalid;
 	int bw, oldbw;
+	int resizepending; /* geometry not yet sent, see flushresizes() */
 	unsigned int tags;
   int wasfloating, iscentered, isfixed, isfloating, isalwaysontop, isurgent, neverfocus, oldstate, isfullscreen, issticky, cantfocus, isterminal, noswallow, resizehints, noautofocus;
 	pid_t pid;
@@ -186,6 +187,17 @@ struct Monitor {
 	Pertag *pertag;
 };
 
+/* open addressing hash table, keyed by windows or pids */
+typedef struct {
+	unsigned long key; /* 0 marks a free slot */
+	void *val;
+} Slot;
+
+typedef struct {
+	Slot *slots;
+	size_t size, n; /* size is a power of two */
+} Map;
+
 typedef struct {
 	const char *class;
 	const char *instance;
@@ -243,6 +255,7 @@ static void drawbar(Monitor *m);
 static void drawbars(void);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
+static int flushresizes(void);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmaster(const Arg *arg);
@@ -265,8 +278,12 @@ static void killclient(const Arg *arg);
 static void layoutmenu(const Arg *arg);
 static void layoutscroll(const Arg *arg);
 static void manage(Window w, XWindowAttributes *wa);
+static void mapdel(Map *map, unsigned long key);
+static void *mapget(const Map *map, unsigned long key);
+static size_t maphash(const Map *map, unsigned long key);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
+static void mapset(Map *map, unsigned long key, void *val);
 static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void ntoggleview(const Arg *arg);
@@ -370,7 +387,6 @@ static void load_xresources(void);
 static void resource_load(XrmDatabase db, char *name, enum resource_type rtype, void *dst);
 
 static pid_t getparentprocess(pid_t p);
-static int isdescprocess(pid_t p, pid_t c);
 static Client *swallowingclient(Window w);
 static Client *termforwin(const Client *c);
 static pid_t winpid(Window w);
@@ -390,6 +406,7 @@ static int vp;               /* vertical padding for bar */
 static int sp;               /* side padding for bar */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
+static int batchresizes = 0; /* arrange() depth, resizes wait for flushresizes() */
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
 	[ClientMessage] = clientmessage,
@@ -418,6 +435,10 @@ static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
 static Client *mark;
+static Map clientmap;  /* client windows to their clients */
+static Map barmap;     /* bar windows to their monitors */
+static Map swallowmap; /* swallowed windows to the clients swallowing them */
+static Map termmap;    /* terminal pids to their clients */
 static xcb_connection_t *xcon;
 
 static int useargb = 0;
@@ -654,15 +675,25 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 void
 arrange(Monitor *m)
 {
+	int n;
+
+	batchresizes++;
 	if (m)
 		showhide(m->stack);
 	else for (m = mons; m; m = m->next)
 		showhide(m->stack);
-	if (m) {
+	if (m)
 		arrangemon(m);
-		restack(m);
-	} else for (m = mons; m; m = m->next)
+	else for (m = mons; m; m = m->next)
 		arrangemon(m);
+	if (--batchresizes)
+		return;
+	/* one round trip for the whole layout, restack() syncs */
+	n = flushresizes();
+	if (m)
+		restack(m);
+	else if (n)
+		XSync(dpy, False);
 }
 
 void
@@ -708,6 +739,9 @@ swallow(Client *p, Client *c)
 	Window w = p->win;
 	p->win = c->win;
 	c->win = w;
+	mapset(&clientmap, p->win, p);
+	mapdel(&clientmap, c->win);
+	mapset(&swallowmap, c->win, p);
 	updatetitle(p);
 	XMoveResizeWindow(dpy, p->win, p->x, p->y, p->w, p->h);
 	arrange(p->mon);
@@ -718,7 +752,10 @@ swallow(Client *p, Client *c)
 void
 unswallow(Client *c)
 {
+	mapdel(&clientmap, c->win);
+	mapdel(&swallowmap, c->swallowing->win);
 	c->win = c->swallowing->win;
+	mapset(&clientmap, c->win, c);
 
 	free(c->swallowing);
 	c->swallowing = NULL;
@@ -870,6 +907,10 @@ cleanup(void)
 		drw_scm_free(drw, tagscheme[i], 2);
 	free(tagscheme);
 	XDestroyWindow(dpy, wmcheckwin);
+	free(clientmap.slots);
+	free(barmap.slots);
+	free(swallowmap.slots);
+	free(termmap.slots);
 	drw_free(drw);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
@@ -887,6 +928,7 @@ cleanupmon(Monitor *mon)
 		for (m = mons; m && m->next != mon; m = m->next);
 		m->next = mon->next;
 	}
+	mapdel(&barmap, mon->barwin);
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
 	free(mon);
@@ -1288,6 +1330,31 @@ expose(XEvent *e)
 		drawbar(m);
 }
 
+int
+flushresizes(void)
+{
+	Client *c;
+	Monitor *m;
+	XWindowChanges wc;
+	int n = 0;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			if (!c->resizepending)
+				continue;
+			c->resizepending = 0;
+			wc.x = c->x;
+			wc.y = c->y;
+			wc.width = c->w;
+			wc.height = c->h;
+			wc.border_width = c->bw;
+			XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+			configure(c);
+			n++;
+		}
+	return n;
+}
+
 void
 focus(Client *c)
 {
@@ -1807,6 +1874,9 @@ manage(Window w, XWindowAttributes *wa)
   };
 	attach(c);
 	attachstack(c);
+	mapset(&clientmap, c->win, c);
+	if (c->isterminal && c->pid)
+		mapset(&termmap, c->pid, c);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
@@ -1823,6 +1893,52 @@ manage(Window w, XWindowAttributes *wa)
 	focus(NULL);
 }
 
+size_t
+maphash(const Map *map, unsigned long key)
+{
+	/* fibonacci hashing spreads the sequential XIDs and pids */
+	return (size_t)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 32) & (map->size - 1);
+}
+
+void
+mapdel(Map *map, unsigned long key)
+{
+	size_t i, j, k;
+
+	if (!map->n || !key)
+		return;
+	for (i = maphash(map, key); map->slots[i].key != key; i = (i + 1) & (map->size - 1))
+		if (!map->slots[i].key)
+			return;
+	/* shift the following entries back instead of leaving a tombstone */
+	for (j = i; ;) {
+		j = (j + 1) & (map->size - 1);
+		if (!map->slots[j].key)
+			break;
+		k = maphash(map, map->slots[j].key);
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			map->slots[i] = map->slots[j];
+			i = j;
+		}
+	}
+	map->slots[i].key = 0;
+	map->slots[i].val = NULL;
+	map->n--;
+}
+
+void *
+mapget(const Map *map, unsigned long key)
+{
+	size_t i;
+
+	if (!map->n || !key)
+		return NULL;
+	for (i = maphash(map, key); map->slots[i].key; i = (i + 1) & (map->size - 1))
+		if (map->slots[i].key == key)
+			return map->slots[i].val;
+	return NULL;
+}
+
 void
 mappingnotify(XEvent *e)
 {
@@ -1833,6 +1949,29 @@ mappingnotify(XEvent *e)
 		grabkeys();
 }
 
+void
+mapset(Map *map, unsigned long key, void *val)
+{
+	Map old = *map;
+	size_t i;
+
+	/* keep the load at most one half */
+	if (2 * (map->n + 1) > map->size) {
+		map->size = map->size ? 2 * map->size : 64;
+		map->slots = ecalloc(map->size, sizeof(Slot));
+		map->n = 0;
+		for (i = 0; i < old.size; i++)
+			if (old.slots[i].key)
+				mapset(map, old.slots[i].key, old.slots[i].val);
+		free(old.slots);
+	}
+	for (i = maphash(map, key); map->slots[i].key && map->slots[i].key != key; i = (i + 1) & (map->size - 1));
+	if (!map->slots[i].key)
+		map->n++;
+	map->slots[i].key = key;
+	map->slots[i].val = val;
+}
+
 void
 maprequest(XEvent *e)
 {
@@ -2027,6 +2166,9 @@ movemouse(const Arg *arg)
             cl2->w = ocl1.w;
             cl2->h = ocl1.h;
 
+            mapset(&clientmap, cl1->win, cl1);
+            mapset(&clientmap, cl2->win, cl2);
+
             selmon->sel = cl2;
 
             c = cc;
@@ -2201,11 +2343,19 @@ resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
 
+	/* inside arrange() only the final geometry is sent */
+	if (batchresizes && !c->resizepending
+	&& x == c->x && y == c->y && w == c->w && h == c->h)
+		return;
 	c->oldx = c->x; c->x = wc.x = x;
 	c->oldy = c->y; c->y = wc.y = y;
 	c->oldw = c->w; c->w = wc.width = w;
 	c->oldh = c->h; c->h = wc.height = h;
 	c->expandmask = 0;
+	if (batchresizes) {
+		c->resizepending = 1;
+		return;
+	}
 	wc.border_width = c->bw;
 
 	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
@@ -3422,7 +3572,8 @@ void
 unmanage(Client *c, int destroyed)
 {
 	int i;
-	Monitor *m = c->mon;
+	Monitor *m = c->mon, *m2;
+	Client *t;
 	XWindowChanges wc;
 
 	if (c == mark)
@@ -3439,6 +3590,7 @@ unmanage(Client *c, int destroyed)
 
 	Client *s = swallowingclient(c->win);
 	if (s) {
+		mapdel(&swallowmap, c->win);
 		free(s->swallowing);
 		s->swallowing = NULL;
 		arrange(m);
@@ -3448,6 +3600,15 @@ unmanage(Client *c, int destroyed)
 
 	detach(c);
 	detachstack(c);
+	mapdel(&clientmap, c->win);
+	if (c->pid && mapget(&termmap, c->pid) == c) {
+		/* another window of the same terminal process takes over */
+		mapdel(&termmap, c->pid);
+		for (m2 = mons; m2; m2 = m2->next)
+			for (t = m2->clients; t; t = t->next)
+				if (t->isterminal && t->pid == c->pid)
+					mapset(&termmap, t->pid, t);
+	}
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -3515,6 +3676,7 @@ updatebars(void)
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
+		mapset(&barmap, m->barwin, m);
 	}
 }
 
@@ -3536,13 +3698,24 @@ updateclientlist(void)
 {
 	Client *c;
 	Monitor *m;
+	Window *wins;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+			n++;
+	if (!n) {
+		XDeleteProperty(dpy, root, netatom[NetClientList]);
+		return;
+	}
+	wins = ecalloc(n, sizeof(Window));
+	n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			wins[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *)wins, n);
+	free(wins);
 }
 
 int
@@ -3888,30 +4061,19 @@ getparentprocess(pid_t p)
 	return (pid_t)v;
 }
 
-int
-isdescprocess(pid_t p, pid_t c)
-{
-	while (p != c && c != 0)
-		c = getparentprocess(c);
-
-	return (int)c;
-}
-
 Client *
 termforwin(const Client *w)
 {
 	Client *c;
-	Monitor *m;
+	pid_t p;
 
 	if (!w->pid || w->isterminal)
 		return NULL;
 
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->isterminal && !c->swallowing && c->pid && isdescprocess(c->pid, w->pid))
-				return c;
-		}
-	}
+	/* the closest terminal among the window's ancestor processes */
+	for (p = w->pid; p > 1; p = getparentprocess(p))
+		if ((c = mapget(&termmap, p)) && !c->swallowing)
+			return c;
 
 	return NULL;
 }
@@ -3919,17 +4081,7 @@ termforwin(const Client *w)
 Client *
 swallowingclient(Window w)
 {
-	Client *c;
-	Monitor *m;
-
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->swallowing && c->swallowing->win == w)
-				return c;
-		}
-	}
-
-	return NULL;
+	return mapget(&swallowmap, w);
 }
 
 void
@@ -3947,14 +4099,7 @@ viewall(const Arg *arg)
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
-
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	return mapget(&clientmap, w);
 }
 
 Monitor *
@@ -3966,9 +4111,8 @@ wintomon(Window w)
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1);
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin)
-			return m;
+	if ((m = mapget(&barmap, w)))
+		return m;
 	if ((c = wintoclient(w)))
 		return c->mon;
 	return selmon;
@@ -16,7 +16,17 @@
 // Control whether a trailing delimiter should be appended to the status.
 #define TRAILING_DELIMITER 0
 
+// Milliseconds by which block updates may be brought forward to share a wakeup.
+#define TIMER_SLACK 500
+
 // Define blocks for the status feed as X(icon, cmd, interval, signal).
+// Commands starting with '@' are read in-process instead of spawned:
+//   @clock [strftime format], @battery [name], @internet, @cpu, @memory,
+//   @disk [path] and @system [path].
+// For example, X("", "@clock %H:%M", 30, 2) or X("", "@system /home", 5, 9).
+// A click on one of them only updates it.
+// An interval of STREAM keeps the command running instead, and every line it
+// prints becomes the output, e.g. X("", "sb-music-stream", STREAM, 18).
 #define BLOCKS(X)\
   X("", "sb-ylog",                                      900,    21)   \
   X("", "sb-ticker",                                    0,      20)   \
@@ -40,6 +50,15 @@
   X("", "sb-clock",                                     0,      2)    \
   X("", "sb-ecrypt",                                    0,      1)    \
   X("", "sb-help-icon",                                 0,      0)
+
+// Refresh the block with the given signal when a source changes, as X(signal,
+// source). Sources are absolute file paths (a trailing slash watches the
+// whole directory), "netlink:link", "netlink:address" or "uevent:subsystem".
+#define WATCHES(X)\
+  X(19, "/tmp/recordingicon")                                          \
+  X(6,  "netlink:link")                                                \
+  X(6,  "netlink:address")                                             \
+  X(3,  "uevent:power_supply")
 #endif  // CONFIG_H
 
   /* X("", "sb-price xmr-btc \"Monero to Bitcoin\" 🔒 30", 900,    27)   \
@@ -1,21 +1,47 @@
 #ifndef BLOCK_H
 #define BLOCK_H
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "builtin.h"
 #include "config.h"
 #include "util.h"
 
+// Interval of blocks whose command keeps running, each line it prints
+// becoming the new output.
+#define STREAM UINT_MAX
+
 typedef struct {
     const char *const icon;
     const char *const command;
     const unsigned int interval;
     const int signal;
 
-    int pipe[PIPE_FD_COUNT];
+    // Command split into arguments, or run through the shell if it needs one.
+    char **argv;
+
+    // Builtin run in-process instead, see builtin.h.
+    builtin_provider provider;
+    const char *argument;
+    builtin_state state;
+
+    // Read end of the running command's stdout, -1 once it is closed.
+    int fd;
     char output[MAX_BLOCK_OUTPUT_LENGTH * UTF8_MAX_BYTE_COUNT + 1];
+
+    // Set when `output` changes, cleared once the status has taken it in.
+    bool has_changed;
+
+    // First line of the running command's output, or the current line of a
+    // stream, collected as it arrives.
+    char pending[MAX_BLOCK_OUTPUT_LENGTH * UTF8_MAX_BYTE_COUNT + 1];
+    size_t pending_length;
+    bool has_line;
+    int exit_status;
     pid_t fork_pid;
 } block;
 
@@ -23,7 +49,10 @@ block block_new(const char *const icon, const char *const command,
                 const unsigned int interval, const int signal);
 int block_init(block *const block);
 int block_deinit(block *const block);
+bool block_is_stream(const block *const block);
+bool block_is_running(const block *const block);
 int block_execute(block *const block, const uint8_t button);
 int block_update(block *const block);
+int block_reap(block *const block, const int exit_status);
 
 #endif  // BLOCK_H
@@ -0,0 +1,45 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A block whose command starts with this character runs a builtin provider
+// in-process, e.g. "@disk /home". The rest of the command is its argument.
+#define BUILTIN_PREFIX '@'
+
+#define BUILTIN_MAX_INTERFACES 8
+
+typedef struct {
+    char name[32];
+    int fd;
+    bool is_seen;
+} builtin_interface;
+
+// What a builtin keeps between updates of its block, so blocks running the
+// same builtin, e.g. for two batteries, don't share it. Descriptors are -1
+// while closed.
+typedef struct {
+    char battery[64];
+    int capacity_fd;
+    int status_fd;
+
+    builtin_interface interfaces[BUILTIN_MAX_INTERFACES];
+    int wireless_fd;
+
+    int stat_fd;
+    unsigned long long previous_total;
+    unsigned long long previous_idle;
+
+    int meminfo_fd;
+} builtin_state;
+
+typedef int (*builtin_provider)(builtin_state* const state,
+                                char* const output, const size_t size,
+                                const char* const argument);
+
+builtin_provider builtin_find(const char* const name, const size_t length);
+builtin_state builtin_state_new(void);
+int builtin_state_deinit(builtin_state* const state);
+
+#endif  // BUILTIN_H
@@ -13,4 +13,13 @@
 enum { BLOCK_COUNT = LEN(BLOCKS(X)) - 1 };
 #undef X
 
+// Configs without watch sources have an empty list.
+#ifndef WATCHES
+#define WATCHES(X)
+#endif
+
+#define X(...) "."
+enum { WATCH_COUNT = LEN("" WATCHES(X)) - 1 };
+#undef X
+
 #endif  // MAIN_H
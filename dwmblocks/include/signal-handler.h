@@ -4,19 +4,14 @@
 #include <signal.h>
 
 #include "block.h"
-#include "timer.h"
 
 typedef sigset_t signal_set;
 typedef int (*signal_refresh_callback)(block* const blocks,
                                        const unsigned short block_count);
-typedef int (*signal_timer_callback)(block* const blocks,
-                                     const unsigned short block_code,
-                                     timer* const timer);
 
 typedef struct {
     int fd;
     const signal_refresh_callback refresh_callback;
-    const signal_timer_callback timer_callback;
 
     block* const blocks;
     const unsigned short block_count;
@@ -24,10 +19,9 @@ typedef struct {
 
 signal_handler signal_handler_new(
     block* const blocks, const unsigned short block_count,
-    const signal_refresh_callback refresh_callback,
-    const signal_timer_callback timer_callback);
+    const signal_refresh_callback refresh_callback);
 int signal_handler_init(signal_handler* const handler);
 int signal_handler_deinit(signal_handler* const handler);
-int signal_handler_process(signal_handler* const handler, timer* const timer);
+int signal_handler_process(signal_handler* const handler);
 
 #endif  // SIGNAL_HANDLER_H
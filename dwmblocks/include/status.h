@@ -2,6 +2,7 @@
 #define STATUS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "block.h"
 #include "config.h"
@@ -9,21 +10,32 @@
 #include "util.h"
 #include "x11.h"
 
+// Utilise C's adjacent string concatenation to measure all icons at once.
+#define X(icon, ...) icon
+enum { ICONS_LENGTH = LEN("" BLOCKS(X)) - 1 };
+#undef X
+
+// Every segment carries the delimiter in front of it, which is skipped
+// when writing the status without a leading delimiter.
+enum {
+    SEGMENT_LENGTH = LEN(DELIMITER) - 1 + CLICKABLE_BLOCKS +
+                     MEMBER_LENGTH(block, output) - 1,
+};
+
 typedef struct {
-#define STATUS_LENGTH                                                        \
-    ((BLOCK_COUNT * (MEMBER_LENGTH(block, output) - 1) + CLICKABLE_BLOCKS) + \
-     (BLOCK_COUNT - 1 + LEADING_DELIMITER + TRAILING_DELIMITER) *            \
-         (LEN(DELIMITER) - 1) +                                              \
-     1)
-    char current[STATUS_LENGTH];
-    char previous[STATUS_LENGTH];
-#undef STATUS_LENGTH
-
-    const block* const blocks;
+    char current[BLOCK_COUNT * SEGMENT_LENGTH + ICONS_LENGTH +
+                 TRAILING_DELIMITER * (LEN(DELIMITER) - 1) + 1];
+    size_t length;
+
+    // Where each block's segment starts in `current`, followed by the end
+    // of the last one.
+    size_t offsets[BLOCK_COUNT + 1];
+
+    block* const blocks;
     const unsigned short block_count;
 } status;
 
-status status_new(const block* const blocks, const unsigned short block_count);
+status status_new(block* const blocks, const unsigned short block_count);
 bool status_update(status* const status);
 int status_write(const status* const status, const bool is_debug_mode,
                  x11_connection* const connection);
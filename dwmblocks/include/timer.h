@@ -1,21 +1,44 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <signal.h>
-#include <stdbool.h>
+#include <stdint.h>
 
 #include "block.h"
+#include "main.h"
 
-#define TIMER_SIGNAL SIGALRM
+// Configs from before the slack was configurable.
+#ifndef TIMER_SLACK
+#define TIMER_SLACK 500
+#endif
+
+// Seconds to wait before restarting a stream that has ended. The delay
+// doubles while the stream keeps ending sooner than the maximum.
+#define STREAM_MIN_BACKOFF 1
+#define STREAM_MAX_BACKOFF 64
 
 typedef struct {
-    unsigned int time;
-    const unsigned int tick;
-    const unsigned int reset_value;
+    int fd;
+
+    block *const blocks;
+    const unsigned short block_count;
+
+    // Next update of each block, in milliseconds of CLOCK_MONOTONIC.
+    uint64_t deadlines[BLOCK_COUNT];
+
+    // Min-heap of the blocks with an interval or a stream, ordered by
+    // deadline.
+    unsigned short heap[BLOCK_COUNT];
+    unsigned short heap_size;
+
+    // When each stream was last started, and how long its next restart waits.
+    uint64_t starts[BLOCK_COUNT];
+    unsigned int restart_delays[BLOCK_COUNT];
 } timer;
 
-timer timer_new(const block *const blocks, const unsigned short block_count);
-int timer_arm(timer *const timer);
-bool timer_must_run_block(const timer *const timer, const block *const block);
+timer timer_new(block *const blocks, const unsigned short block_count);
+int timer_init(timer *const timer);
+int timer_deinit(timer *const timer);
+int timer_process(timer *const timer);
+int timer_schedule_restarts(timer *const timer);
 
 #endif  // TIMER_H
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define LEN(arr)  (sizeof(arr) / sizeof((arr)[0]))
 #define BIT(n)    (1 << (n))
@@ -21,7 +22,6 @@ enum pipe_fd_index {
     PIPE_FD_COUNT,
 };
 
-unsigned int gcd(unsigned int a, unsigned int b);
 size_t truncate_utf8_string(char* const buffer, const size_t size,
                             const size_t char_limit);
 
@@ -0,0 +1,37 @@
+#ifndef WATCH_SOURCE_H
+#define WATCH_SOURCE_H
+
+#include "block.h"
+#include "main.h"
+
+#define NETLINK_LINK_SOURCE    "netlink:link"
+#define NETLINK_ADDRESS_SOURCE "netlink:address"
+#define UEVENT_SOURCE_PREFIX   "uevent:"
+
+typedef struct {
+    const int signal;
+    const char* const source;
+
+    // Files are watched through their directory, so they may come and go.
+    int descriptor;
+    const char* name;
+} watch;
+
+typedef struct {
+    int inotify_fd;
+    int route_fd;
+    int uevent_fd;
+
+    block* const blocks;
+    const unsigned short block_count;
+    // Terminated by an empty entry, which keeps the array non-empty.
+    watch watches[WATCH_COUNT + 1];
+} watch_source;
+
+watch_source watch_source_new(block* const blocks,
+                              const unsigned short block_count);
+int watch_source_init(watch_source* const source);
+int watch_source_deinit(watch_source* const source);
+int watch_source_process(watch_source* const source);
+
+#endif  // WATCH_SOURCE_H
@@ -6,9 +6,15 @@
 
 #include "block.h"
 #include "main.h"
+#include "watch-source.h"
 
 enum watcher_fd_index {
     SIGNAL_FD = BLOCK_COUNT,
+    TIMER_FD,
+    X11_FD,
+    INOTIFY_FD,
+    ROUTE_FD,
+    UEVENT_FD,
     WATCHER_FD_COUNT,
 };
 
@@ -16,13 +22,19 @@ typedef struct pollfd watcher_fd;
 
 typedef struct {
     watcher_fd fds[WATCHER_FD_COUNT];
+    const block* blocks;
     unsigned short active_blocks[BLOCK_COUNT];
     unsigned short active_block_count;
     bool got_signal;
+    bool got_timer;
+    bool got_x11_event;
+    bool got_watch_event;
 } watcher;
 
 int watcher_init(watcher *const watcher, const block *const blocks,
-                 const unsigned short block_count, const int signal_fd);
+                 const unsigned short block_count, const int signal_fd,
+                 const int timer_fd, const int x11_fd,
+                 const watch_source *const source);
 int watcher_poll(watcher *const watcher, const int timeout_ms);
 
 #endif  // WATCHER_H
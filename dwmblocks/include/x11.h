@@ -7,7 +7,9 @@ typedef xcb_connection_t x11_connection;
 
 x11_connection* x11_connection_open(void);
 void x11_connection_close(x11_connection* const connection);
+int x11_connection_fd(x11_connection* const connection);
 int x11_set_root_name(x11_connection* const connection,
                       const char* const name);
+int x11_process_events(x11_connection* const connection);
 
 #endif  // X11_H
@@ -1,5 +1,9 @@
 #include "block.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -7,12 +11,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
+#include "builtin.h"
 #include "config.h"
 #include "util.h"
 
+#define SHELL_METACHARACTERS "|&;<>()$`\\\"'*?[]#~=%{}\n"
+
+extern char **environ;
+
+// Split a command at blanks, unless it needs a shell to be run. The
+// arguments live in the same allocation as the pointers to them.
+static char **split_command(const char *const command) {
+    const bool needs_shell = strpbrk(command, SHELL_METACHARACTERS) != NULL;
+    const size_t length = strlen(command) + 1;
+    size_t argc = needs_shell ? 3 : 0;
+
+    if (!needs_shell) {
+        for (const char *c = command; *c != '\0'; ++c) {
+            if ((c == command || c[-1] == ' ' || c[-1] == '\t') && *c != ' ' &&
+                *c != '\t') {
+                ++argc;
+            }
+        }
+    }
+
+    char **const argv = malloc((argc + 1) * sizeof(*argv) + length);
+    if (argv == NULL) {
+        return NULL;
+    }
+
+    char *const buffer = (char *)(argv + argc + 1);
+    (void)memcpy(buffer, command, length);
+    if (needs_shell) {
+        argv[0] = "/bin/sh";
+        argv[1] = "-c";
+        argv[2] = buffer;
+        argv[3] = NULL;
+        return argv;
+    }
+
+    size_t i = 0;
+    for (char *arg = strtok(buffer, " \t"); arg != NULL;
+         arg = strtok(NULL, " \t")) {
+        argv[i++] = arg;
+    }
+    argv[i] = NULL;
+
+    return argv;
+}
+
 block block_new(const char *const icon, const char *const command,
                 const unsigned int interval, const int signal) {
     block block = {
@@ -21,7 +70,14 @@ block block_new(const char *const icon, const char *const command,
         .interval = interval,
         .signal = signal,
 
+        .argv = NULL,
+        .provider = NULL,
+        .argument = NULL,
+        .state = builtin_state_new(),
+        .fd = -1,
         .output = {[0] = '\0'},
+        .has_changed = false,
+        .pending = {[0] = '\0'},
         .fork_pid = -1,
     };
 
@@ -29,9 +85,22 @@ block block_new(const char *const icon, const char *const command,
 }
 
 int block_init(block *const block) {
-    if (pipe(block->pipe) != 0) {
-        (void)fprintf(stderr,
-                      "error: could not create a pipe for \"%s\" block\n",
+    if (block->command[0] == BUILTIN_PREFIX) {
+        const char *const name = block->command + 1;
+        const size_t length = strcspn(name, " \t");
+        block->provider = builtin_find(name, length);
+        if (block->provider == NULL) {
+            (void)fprintf(stderr, "error: unknown builtin in \"%s\" block\n",
+                          block->command);
+            return 1;
+        }
+        block->argument = name + length + strspn(name + length, " \t");
+        return 0;
+    }
+
+    block->argv = split_command(block->command);
+    if (block->argv == NULL || block->argv[0] == NULL) {
+        (void)fprintf(stderr, "error: could not parse \"%s\" block\n",
                       block->command);
         return 1;
     }
@@ -40,108 +109,280 @@ int block_init(block *const block) {
 }
 
 int block_deinit(block *const block) {
-    int status = close(block->pipe[READ_END]);
-    status |= close(block->pipe[WRITE_END]);
-    if (status != 0) {
+    free(block->argv);
+    block->argv = NULL;
+
+    if (builtin_state_deinit(&block->state) != 0) {
+        (void)fprintf(stderr, "error: could not close \"%s\" block's files\n",
+                      block->command);
+        return 1;
+    }
+
+    if (block->fd != -1 && close(block->fd) != 0) {
         (void)fprintf(stderr, "error: could not close \"%s\" block's pipe\n",
                       block->command);
         return 1;
     }
+    block->fd = -1;
+
+    return 0;
+}
+
+// Unchanged output leaves the status alone.
+static void block_set_output(block *const block, char *const buffer,
+                             const size_t size) {
+    (void)truncate_utf8_string(buffer, size, MAX_BLOCK_OUTPUT_LENGTH);
+    if (strcmp(buffer, block->output) == 0) {
+        return;
+    }
+
+    (void)strncpy(block->output, buffer, LEN(block->output));
+    block->has_changed = true;
+}
+
+static int block_run_builtin(block *const block) {
+    char buffer[LEN(block->output)] = {[0] = '\0'};
+    if (block->provider(&block->state, buffer, LEN(buffer), block->argument) !=
+        0) {
+        (void)fprintf(stderr, "error: \"%s\" block failed\n", block->command);
+        return 0;
+    }
+
+    block_set_output(block, buffer, LEN(buffer));
 
     return 0;
 }
 
+bool block_is_stream(const block *const block) {
+    return block->interval == STREAM;
+}
+
+bool block_is_running(const block *const block) {
+    return block->fork_pid != -1 || block->fd != -1;
+}
+
 int block_execute(block *const block, const uint8_t button) {
+    if (block->provider != NULL) {
+        // Builtins have no click actions, a click just updates them.
+        return block_run_builtin(block);
+    }
+
     // Ensure only one child process exists per block at an instance.
-    if (block->fork_pid != -1) {
+    if (block_is_running(block)) {
         return 0;
     }
 
-    block->fork_pid = fork();
-    if (block->fork_pid == -1) {
-        (void)fprintf(
-            stderr, "error: could not create a subprocess for \"%s\" block\n",
-            block->command);
+    int pipe_fds[PIPE_FD_COUNT];
+    if (pipe(pipe_fds) != 0) {
+        (void)fprintf(stderr,
+                      "error: could not create a pipe for \"%s\" block\n",
+                      block->command);
         return 1;
     }
+    (void)fcntl(pipe_fds[READ_END], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(pipe_fds[READ_END], F_SETFL, O_NONBLOCK);
+    (void)fcntl(pipe_fds[WRITE_END], F_SETFD, FD_CLOEXEC);
 
-    if (block->fork_pid == 0) {
-        const int write_fd = block->pipe[WRITE_END];
-        int status = close(block->pipe[READ_END]);
+    // The child gets the pipe as its stdout and none of the signals
+    // blocked for the signal handler.
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    sigset_t mask;
+    (void)sigemptyset(&mask);
+    (void)posix_spawn_file_actions_init(&actions);
+    (void)posix_spawn_file_actions_adddup2(&actions, pipe_fds[WRITE_END],
+                                           STDOUT_FILENO);
+    (void)posix_spawnattr_init(&attributes);
+    (void)posix_spawnattr_setsigmask(&attributes, &mask);
+    (void)posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
 
-        if (button != 0) {
-            char button_str[4];
-            (void)snprintf(button_str, LEN(button_str), "%hhu", button);
-            status |= setenv("BLOCK_BUTTON", button_str, 1);
-        }
+    if (button != 0) {
+        char button_str[4];
+        (void)snprintf(button_str, LEN(button_str), "%hhu", button);
+        (void)setenv("BLOCK_BUTTON", button_str, 1);
+    }
 
-        const char null = '\0';
-        if (status != 0) {
-            (void)write(write_fd, &null, sizeof(null));
-            exit(EXIT_FAILURE);
-        }
+    const int status =
+        posix_spawnp(&block->fork_pid, block->argv[0], &actions, &attributes,
+                     block->argv, environ);
 
-        FILE *const file = popen(block->command, "r");
-        if (file == NULL) {
-            (void)write(write_fd, &null, sizeof(null));
-            exit(EXIT_FAILURE);
-        }
+    if (button != 0) {
+        (void)unsetenv("BLOCK_BUTTON");
+    }
+    (void)posix_spawnattr_destroy(&attributes);
+    (void)posix_spawn_file_actions_destroy(&actions);
+    (void)close(pipe_fds[WRITE_END]);
+
+    if (status != 0) {
+        (void)close(pipe_fds[READ_END]);
+        block->fork_pid = -1;
+        (void)fprintf(stderr, "error: could not run \"%s\" block: %s\n",
+                      block->command, strerror(status));
+        return 0;
+    }
+
+    block->fd = pipe_fds[READ_END];
+    block->pending_length = 0;
+    block->has_line = false;
+    block->exit_status = 0;
 
-        // Ensure null-termination since fgets() will leave buffer untouched on
-        // no output.
-        char buffer[LEN(block->output)] = {[0] = null};
-        (void)fgets(buffer, LEN(buffer), file);
+    return 0;
+}
 
-        // Remove trailing newlines.
-        const size_t length = strcspn(buffer, "\n");
-        buffer[length] = null;
+// Every complete line of a stream replaces the output. Lines too long for the
+// block are cut, and the rest of them is skipped.
+static void block_read_stream(block *const block, const char *buffer,
+                              const size_t size) {
+    const char *const end = buffer + size;
+    while (buffer < end) {
+        const char *const newline = memchr(buffer, '\n', end - buffer);
+        const char *const stop = newline != NULL ? newline : end;
 
-        // Exit if command execution failed or if file could not be closed.
-        if (pclose(file) != 0) {
-            (void)write(write_fd, &null, sizeof(null));
-            exit(EXIT_FAILURE);
+        if (!block->has_line) {
+            const size_t room =
+                LEN(block->pending) - 1 - block->pending_length;
+            size_t length = stop - buffer;
+            if (length >= room) {
+                length = room;
+                block->has_line = true;
+            }
+            (void)memcpy(block->pending + block->pending_length, buffer,
+                         length);
+            block->pending_length += length;
         }
 
-        const size_t output_size =
-            truncate_utf8_string(buffer, LEN(buffer), MAX_BLOCK_OUTPUT_LENGTH);
-        (void)write(write_fd, buffer, output_size);
+        if (newline == NULL) {
+            break;
+        }
 
-        exit(EXIT_SUCCESS);
+        block->pending[block->pending_length] = '\0';
+        block_set_output(block, block->pending, LEN(block->pending));
+        block->pending_length = 0;
+        block->has_line = false;
+        buffer = newline + 1;
     }
-
-    return 0;
 }
 
-int block_update(block *const block) {
-    char buffer[LEN(block->output)];
+// Drain the pipe, keeping the first line of the output.
+static int block_read(block *const block) {
+    char buffer[BUFSIZ];
+    ssize_t bytes_read;
+
+    while ((bytes_read = read(block->fd, buffer, LEN(buffer))) > 0) {
+        if (block_is_stream(block)) {
+            block_read_stream(block, buffer, bytes_read);
+            continue;
+        }
 
-    const ssize_t bytes_read =
-        read(block->pipe[READ_END], buffer, LEN(buffer));
-    if (bytes_read == -1) {
+        if (block->has_line) {
+            continue;
+        }
+
+        const size_t room = LEN(block->pending) - 1 - block->pending_length;
+        const char *const newline = memchr(buffer, '\n', bytes_read);
+        size_t length = newline != NULL ? (size_t)(newline - buffer)
+                                        : (size_t)bytes_read;
+        if (length >= room) {
+            length = room;
+            block->has_line = true;
+        }
+        (void)memcpy(block->pending + block->pending_length, buffer, length);
+        block->pending_length += length;
+        block->has_line |= newline != NULL;
+    }
+
+    if (bytes_read == -1 && errno != EAGAIN && errno != EINTR) {
         (void)fprintf(stderr,
                       "error: could not fetch output of \"%s\" block\n",
                       block->command);
+        (void)close(block->fd);
+        block->fd = -1;
         return 2;
     }
 
-    // Collect exit-status of the subprocess to avoid zombification.
-    int fork_status = 0;
-    if (waitpid(block->fork_pid, &fork_status, 0) == -1) {
+    if (bytes_read == 0) {
+        (void)close(block->fd);
+        block->fd = -1;
+    }
+
+    return 0;
+}
+
+// A stream ends once its command has exited and the pipe is closed. The
+// timer restarts it, see timer_schedule_restarts().
+static int block_finish_stream(block *const block) {
+    if (block_is_running(block)) {
+        return 0;
+    }
+
+    // A last line without a newline still counts.
+    if (block->pending_length > 0) {
+        block->pending[block->pending_length] = '\0';
+        block_set_output(block, block->pending, LEN(block->pending));
+        block->pending_length = 0;
+    }
+
+    if (block->exit_status != 0) {
         (void)fprintf(stderr,
-                      "error: could not obtain exit status for \"%s\" block\n",
+                      "error: \"%s\" stream exited with non-zero status\n",
                       block->command);
-        return 2;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Take over the output once the command has exited and its first line,
+// or the end of its output, has been read.
+static int block_finish(block *const block) {
+    if (block_is_stream(block)) {
+        return block_finish_stream(block);
+    }
+
+    if (block->fork_pid != -1 || (block->fd != -1 && !block->has_line)) {
+        return 0;
+    }
+
+    // Anything its own children print after the first line is ignored.
+    if (block->fd != -1) {
+        (void)close(block->fd);
+        block->fd = -1;
     }
-    block->fork_pid = -1;
 
-    if (fork_status != 0) {
+    if (block->exit_status != 0) {
         (void)fprintf(stderr,
                       "error: \"%s\" block exited with non-zero status\n",
                       block->command);
         return 1;
     }
 
-    (void)strncpy(block->output, buffer, LEN(buffer));
+    block->pending[block->pending_length] = '\0';
+    block_set_output(block, block->pending, LEN(block->pending));
 
     return 0;
 }
+
+int block_update(block *const block) {
+    // The pipe's hangup may be reported after the block has finished.
+    if (block->fd == -1) {
+        return 0;
+    }
+
+    if (block_read(block) != 0) {
+        return 2;
+    }
+
+    return block_finish(block);
+}
+
+int block_reap(block *const block, const int exit_status) {
+    block->fork_pid = -1;
+    block->exit_status = exit_status;
+
+    // Output still in the pipe was written before the command exited.
+    if (block->fd != -1 && block_read(block) != 0) {
+        return 2;
+    }
+
+    return block_finish(block);
+}
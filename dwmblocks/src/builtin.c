@@ -0,0 +1,392 @@
+#include "builtin.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define POWER_SUPPLY_DIR "/sys/class/power_supply"
+#define NET_DIR          "/sys/class/net"
+
+typedef struct {
+    const char* const name;
+    const builtin_provider provider;
+} builtin;
+
+// Read a small kernel file from offset 0. The descriptor stays open for the
+// next update and is reopened if reading fails, e.g. after a hotplug.
+static int read_file(int* const fd, const char* const path, char* const buffer,
+                     const size_t size) {
+    if (*fd == -1) {
+        *fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (*fd == -1) {
+            return 1;
+        }
+    }
+
+    const ssize_t bytes_read = pread(*fd, buffer, size - 1, 0);
+    if (bytes_read <= 0) {
+        (void)close(*fd);
+        *fd = -1;
+        return 1;
+    }
+
+    buffer[bytes_read] = '\0';
+
+    return 0;
+}
+
+static int read_line(int* const fd, const char* const path, char* const buffer,
+                     const size_t size) {
+    if (read_file(fd, path, buffer, size) != 0) {
+        return 1;
+    }
+
+    buffer[strcspn(buffer, "\n")] = '\0';
+
+    return 0;
+}
+
+static int clock_provider(builtin_state* const state, char* const output,
+                          const size_t size, const char* const argument) {
+    (void)state;
+
+    const time_t now = time(NULL);
+    struct tm local;
+    if (localtime_r(&now, &local) == NULL) {
+        return 1;
+    }
+
+    const char* const format =
+        argument[0] != '\0' ? argument : "%a %d %b %I:%M%p";
+    return strftime(output, size, format, &local) == 0;
+}
+
+static int battery_provider(builtin_state* const state, char* const output,
+                            const size_t size, const char* const argument) {
+    char* const name = state->battery;
+
+    // Without an argument, the first battery found is shown.
+    if (state->capacity_fd == -1 && argument[0] == '\0') {
+        DIR* const dir = opendir(POWER_SUPPLY_DIR);
+        if (dir == NULL) {
+            return 1;
+        }
+
+        const struct dirent* entry;
+        name[0] = '\0';
+        while ((entry = readdir(dir)) != NULL) {
+            const size_t length = strlen(entry->d_name);
+            if (strncmp(entry->d_name, "BAT", 3) == 0 &&
+                length < LEN(state->battery)) {
+                (void)memcpy(name, entry->d_name, length + 1);
+                break;
+            }
+        }
+        (void)closedir(dir);
+    } else if (name[0] == '\0') {
+        (void)snprintf(name, LEN(state->battery), "%s", argument);
+    }
+    // Machines without a battery just show nothing.
+    if (name[0] == '\0') {
+        return 0;
+    }
+
+    char path[128];
+    char capacity[16];
+    char status[32];
+    (void)snprintf(path, LEN(path), POWER_SUPPLY_DIR "/%s/capacity", name);
+    if (read_line(&state->capacity_fd, path, capacity, LEN(capacity)) != 0) {
+        return 1;
+    }
+    (void)snprintf(path, LEN(path), POWER_SUPPLY_DIR "/%s/status", name);
+    if (read_line(&state->status_fd, path, status, LEN(status)) != 0) {
+        return 1;
+    }
+
+    const char* icon = "♻️";
+    if (strcmp(status, "Charging") == 0) {
+        icon = "🔌";
+    } else if (strcmp(status, "Discharging") == 0) {
+        icon = "🔋";
+    } else if (strcmp(status, "Full") == 0) {
+        icon = "⚡";
+    } else if (strcmp(status, "Not charging") == 0) {
+        icon = "🛑";
+    }
+
+    (void)snprintf(output, size, "%s%s%%", icon, capacity);
+    return 0;
+}
+
+static int internet_provider(builtin_state* const state, char* const output,
+                             const size_t size, const char* const argument) {
+    builtin_interface* const interfaces = state->interfaces;
+    (void)argument;
+
+    DIR* const dir = opendir(NET_DIR);
+    if (dir == NULL) {
+        return 1;
+    }
+
+    for (unsigned short i = 0; i < BUILTIN_MAX_INTERFACES; ++i) {
+        interfaces[i].is_seen = false;
+    }
+
+    bool wifi_up = false;
+    bool wifi_seen = false;
+    bool ethernet_up = false;
+    const struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const bool is_wifi = entry->d_name[0] == 'w';
+        if (!is_wifi && entry->d_name[0] != 'e') {
+            continue;
+        }
+
+        // Keep one open operstate per interface, free slots have no name.
+        unsigned short i = 0;
+        unsigned short slot = BUILTIN_MAX_INTERFACES;
+        for (; i < BUILTIN_MAX_INTERFACES; ++i) {
+            if (strcmp(interfaces[i].name, entry->d_name) == 0) {
+                break;
+            }
+            if (slot == BUILTIN_MAX_INTERFACES &&
+                interfaces[i].name[0] == '\0') {
+                slot = i;
+            }
+        }
+        if (i == BUILTIN_MAX_INTERFACES) {
+            const size_t length = strlen(entry->d_name);
+            if (slot == BUILTIN_MAX_INTERFACES ||
+                length >= LEN(interfaces[i].name)) {
+                continue;
+            }
+            i = slot;
+            (void)memcpy(interfaces[i].name, entry->d_name, length + 1);
+            interfaces[i].fd = -1;
+        }
+        interfaces[i].is_seen = true;
+
+        char path[128];
+        char operstate[16];
+        (void)snprintf(path, LEN(path), NET_DIR "/%.*s/operstate",
+                       (int)LEN(interfaces[i].name), interfaces[i].name);
+        if (read_line(&interfaces[i].fd, path, operstate, LEN(operstate)) !=
+            0) {
+            interfaces[i].name[0] = '\0';
+            continue;
+        }
+
+        const bool is_up = strcmp(operstate, "up") == 0;
+        if (is_wifi) {
+            wifi_seen = true;
+            wifi_up |= is_up;
+        } else {
+            ethernet_up |= is_up;
+        }
+    }
+    (void)closedir(dir);
+
+    // Forget the interfaces that are gone.
+    for (unsigned short i = 0; i < BUILTIN_MAX_INTERFACES; ++i) {
+        if (interfaces[i].name[0] != '\0' && !interfaces[i].is_seen) {
+            if (interfaces[i].fd != -1) {
+                (void)close(interfaces[i].fd);
+            }
+            interfaces[i].name[0] = '\0';
+        }
+    }
+
+    // Link quality of the first wireless interface, out of 70.
+    int quality = -1;
+    char wireless[512];
+    if (wifi_up && read_file(&state->wireless_fd, "/proc/net/wireless",
+                             wireless, LEN(wireless)) == 0) {
+        // Skip the two header lines of the table.
+        const char* line = strchr(wireless, '\n');
+        line = line != NULL ? strchr(line + 1, '\n') : NULL;
+        const char* const colon = line != NULL ? strchr(line, ':') : NULL;
+        if (colon == NULL || sscanf(colon + 1, "%*s %d", &quality) != 1) {
+            quality = -1;
+        }
+    }
+
+    const char* const wifi_icon = wifi_up ? "📶" : wifi_seen ? "📡" : "";
+    const char* const ethernet_icon = ethernet_up ? "🌐" : "❎";
+    if (quality >= 0) {
+        (void)snprintf(output, size, "%s%d%% %s", wifi_icon,
+                       quality * 100 / 70, ethernet_icon);
+    } else {
+        (void)snprintf(output, size, "%s%s%s", wifi_icon,
+                       wifi_icon[0] != '\0' ? " " : "", ethernet_icon);
+    }
+
+    return 0;
+}
+
+// Busy share of the CPU time since the previous update.
+static int cpu_usage(builtin_state* const state, int* const percent) {
+    char buffer[256];
+    if (read_file(&state->stat_fd, "/proc/stat", buffer, LEN(buffer)) != 0) {
+        return 1;
+    }
+
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    if (sscanf(buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user,
+               &nice, &system, &idle, &iowait, &irq, &softirq, &steal) != 8) {
+        return 1;
+    }
+
+    const unsigned long long total =
+        user + nice + system + idle + iowait + irq + softirq + steal;
+    const unsigned long long idle_total = idle + iowait;
+    const unsigned long long delta = total - state->previous_total;
+    *percent =
+        delta == 0
+            ? 0
+            : (int)(100 * (delta - (idle_total - state->previous_idle)) /
+                    delta);
+    state->previous_total = total;
+    state->previous_idle = idle_total;
+
+    return 0;
+}
+
+static int cpu_provider(builtin_state* const state, char* const output,
+                        const size_t size, const char* const argument) {
+    (void)argument;
+
+    int percent;
+    if (cpu_usage(state, &percent) != 0) {
+        return 1;
+    }
+
+    (void)snprintf(output, size, "🖥%d%%", percent);
+    return 0;
+}
+
+static int memory_provider(builtin_state* const state, char* const output,
+                           const size_t size, const char* const argument) {
+    (void)argument;
+
+    char buffer[256];
+    if (read_file(&state->meminfo_fd, "/proc/meminfo", buffer,
+                  LEN(buffer)) != 0) {
+        return 1;
+    }
+
+    unsigned long total_kb, available_kb;
+    const char* const total = strstr(buffer, "MemTotal:");
+    const char* const available = strstr(buffer, "MemAvailable:");
+    if (total == NULL || available == NULL ||
+        sscanf(total, "MemTotal: %lu", &total_kb) != 1 ||
+        sscanf(available, "MemAvailable: %lu", &available_kb) != 1) {
+        return 1;
+    }
+
+    const double gib = 1024.0 * 1024.0;
+    (void)snprintf(output, size, "🧠%.1f/%.1fG",
+                   (double)(total_kb - available_kb) / gib,
+                   (double)total_kb / gib);
+    return 0;
+}
+
+static int disk_provider(builtin_state* const state, char* const output,
+                         const size_t size, const char* const argument) {
+    (void)state;
+
+    const char* const path = argument[0] != '\0' ? argument : "/";
+    struct statvfs stats;
+    if (statvfs(path, &stats) != 0) {
+        return 1;
+    }
+
+    const double gib = 1024.0 * 1024.0 * 1024.0;
+    const double block_size = (double)stats.f_frsize;
+    (void)snprintf(output, size, "💽%.0f/%.0fG",
+                   (double)(stats.f_blocks - stats.f_bfree) * block_size / gib,
+                   (double)stats.f_blocks * block_size / gib);
+    return 0;
+}
+
+// CPU, memory and disk of the given path in one block.
+static int system_provider(builtin_state* const state, char* const output,
+                           const size_t size, const char* const argument) {
+    char cpu[32];
+    char memory[64];
+    char disk[64];
+    if (cpu_provider(state, cpu, LEN(cpu), "") != 0 ||
+        memory_provider(state, memory, LEN(memory), "") != 0 ||
+        disk_provider(state, disk, LEN(disk), argument) != 0) {
+        return 1;
+    }
+
+    (void)snprintf(output, size, "%s %s %s", cpu, memory, disk);
+    return 0;
+}
+
+static const builtin builtins[] = {
+    {"battery", battery_provider}, {"clock", clock_provider},
+    {"cpu", cpu_provider},         {"disk", disk_provider},
+    {"internet", internet_provider}, {"memory", memory_provider},
+    {"system", system_provider},
+};
+
+builtin_provider builtin_find(const char* const name, const size_t length) {
+    for (unsigned short i = 0; i < LEN(builtins); ++i) {
+        if (strlen(builtins[i].name) == length &&
+            strncmp(builtins[i].name, name, length) == 0) {
+            return builtins[i].provider;
+        }
+    }
+
+    return NULL;
+}
+
+builtin_state builtin_state_new(void) {
+    builtin_state state = {
+        .battery = {[0] = '\0'},
+        .capacity_fd = -1,
+        .status_fd = -1,
+        .wireless_fd = -1,
+        .stat_fd = -1,
+        .previous_total = 0,
+        .previous_idle = 0,
+        .meminfo_fd = -1,
+    };
+
+    return state;
+}
+
+int builtin_state_deinit(builtin_state* const state) {
+    int* const fds[] = {&state->capacity_fd, &state->status_fd,
+                        &state->wireless_fd, &state->stat_fd,
+                        &state->meminfo_fd};
+    int status = 0;
+    for (unsigned short i = 0; i < LEN(fds); ++i) {
+        if (*fds[i] != -1 && close(*fds[i]) != 0) {
+            status = 1;
+        }
+        *fds[i] = -1;
+    }
+
+    for (unsigned short i = 0; i < BUILTIN_MAX_INTERFACES; ++i) {
+        if (state->interfaces[i].name[0] != '\0' &&
+            state->interfaces[i].fd != -1 &&
+            close(state->interfaces[i].fd) != 0) {
+            status = 1;
+        }
+        state->interfaces[i].name[0] = '\0';
+    }
+
+    return status;
+}
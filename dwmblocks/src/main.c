@@ -11,6 +11,7 @@
 #include "status.h"
 #include "timer.h"
 #include "util.h"
+#include "watch-source.h"
 #include "watcher.h"
 #include "x11.h"
 
@@ -38,14 +39,8 @@ static int deinit_blocks(block *const blocks,
 }
 
 static int execute_blocks(block *const blocks,
-                          const unsigned short block_count,
-                          const timer *const timer) {
+                          const unsigned short block_count) {
     for (unsigned short i = 0; i < block_count; ++i) {
-        block *const block = &blocks[i];
-        if (!timer_must_run_block(timer, block)) {
-            continue;
-        }
-
         if (block_execute(&blocks[i], 0) != 0) {
             return 1;
         }
@@ -54,41 +49,20 @@ static int execute_blocks(block *const blocks,
     return 0;
 }
 
-static int trigger_event(block *const blocks, const unsigned short block_count,
-                         timer *const timer) {
-    if (execute_blocks(blocks, block_count, timer) != 0) {
-        return 1;
-    }
-
-    if (timer_arm(timer) != 0) {
-        return 1;
-    }
-
-    return 0;
-}
-
-static int refresh_callback(block *const blocks,
-                            const unsigned short block_count) {
-    if (execute_blocks(blocks, block_count, NULL) != 0) {
-        return 1;
-    }
-
-    return 0;
-}
-
 static int event_loop(block *const blocks, const unsigned short block_count,
                       const bool is_debug_mode,
                       x11_connection *const connection,
-                      signal_handler *const signal_handler) {
-    timer timer = timer_new(blocks, block_count);
-
+                      signal_handler *const signal_handler,
+                      watch_source *const watch_source, timer *const timer) {
     // Kickstart the event loop with an initial execution.
-    if (trigger_event(blocks, block_count, &timer) != 0) {
+    if (execute_blocks(blocks, block_count) != 0) {
         return 1;
     }
 
     watcher watcher;
-    if (watcher_init(&watcher, blocks, block_count, signal_handler->fd) != 0) {
+    if (watcher_init(&watcher, blocks, block_count, signal_handler->fd,
+                     timer->fd, x11_connection_fd(connection),
+                     watch_source) != 0) {
         return 1;
     }
 
@@ -100,13 +74,31 @@ static int event_loop(block *const blocks, const unsigned short block_count,
         }
 
         if (watcher.got_signal) {
-            is_alive = signal_handler_process(signal_handler, &timer) == 0;
+            is_alive = signal_handler_process(signal_handler) == 0;
+        }
+
+        if (watcher.got_timer && timer_process(timer) != 0) {
+            return 1;
+        }
+
+        if (watcher.got_x11_event && x11_process_events(connection) != 0) {
+            return 1;
+        }
+
+        if (watcher.got_watch_event &&
+            watch_source_process(watch_source) != 0) {
+            return 1;
         }
 
         for (unsigned short i = 0; i < watcher.active_block_count; ++i) {
             (void)block_update(&blocks[watcher.active_blocks[i]]);
         }
 
+        if (timer_schedule_restarts(timer) != 0) {
+            return 1;
+        }
+
+        // Everything that changed during this iteration is written at once.
         const bool has_status_changed = status_update(&status);
         if (has_status_changed &&
             status_write(&status, is_debug_mode, connection) != 0) {
@@ -140,15 +132,36 @@ int main(const int argc, const char *const argv[]) {
         goto x11_close;
     }
 
-    signal_handler signal_handler = signal_handler_new(
-        blocks, block_count, refresh_callback, trigger_event);
+    signal_handler signal_handler =
+        signal_handler_new(blocks, block_count, execute_blocks);
     if (signal_handler_init(&signal_handler) != 0) {
         status = 1;
         goto deinit_blocks;
     }
 
+    watch_source watch_source = watch_source_new(blocks, block_count);
+    if (watch_source_init(&watch_source) != 0) {
+        status = 1;
+        goto deinit_watch_source;
+    }
+
+    timer timer = timer_new(blocks, block_count);
+    if (timer_init(&timer) != 0) {
+        status = 1;
+        goto deinit_watch_source;
+    }
+
     if (event_loop(blocks, block_count, cli_args.is_debug_mode, connection,
-                   &signal_handler) != 0) {
+                   &signal_handler, &watch_source, &timer) != 0) {
+        status = 1;
+    }
+
+    if (timer_deinit(&timer) != 0) {
+        status = 1;
+    }
+
+deinit_watch_source:
+    if (watch_source_deinit(&watch_source) != 0) {
         status = 1;
     }
 
@@ -5,21 +5,19 @@
 #include <stdio.h>
 #include <sys/signalfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "block.h"
 #include "main.h"
-#include "timer.h"
 
 typedef struct signalfd_siginfo signal_info;
 
 signal_handler signal_handler_new(
     block *const blocks, const unsigned short block_count,
-    const signal_refresh_callback refresh_callback,
-    const signal_timer_callback timer_callback) {
+    const signal_refresh_callback refresh_callback) {
     signal_handler handler = {
         .refresh_callback = refresh_callback,
-        .timer_callback = timer_callback,
 
         .blocks = blocks,
         .block_count = block_count,
@@ -28,6 +26,21 @@ signal_handler signal_handler_new(
     return handler;
 }
 
+// Pending SIGCHLDs are merged into one, so every exited child is collected.
+static void reap_children(signal_handler *const handler) {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (unsigned short i = 0; i < handler->block_count; ++i) {
+            block *const block = &handler->blocks[i];
+            if (block->fork_pid == pid) {
+                (void)block_reap(block, status);
+                break;
+            }
+        }
+    }
+}
+
 int signal_handler_init(signal_handler *const handler) {
     signal_set set;
     (void)sigemptyset(&set);
@@ -35,8 +48,8 @@ int signal_handler_init(signal_handler *const handler) {
     // Handle user-generated signal for refreshing the status.
     (void)sigaddset(&set, REFRESH_SIGNAL);
 
-    // Handle SIGALRM generated by the timer.
-    (void)sigaddset(&set, TIMER_SIGNAL);
+    // Handle exiting block commands.
+    (void)sigaddset(&set, SIGCHLD);
 
     // Handle termination signals.
     (void)sigaddset(&set, SIGINT);
@@ -83,7 +96,7 @@ int signal_handler_deinit(signal_handler *const handler) {
     return 0;
 }
 
-int signal_handler_process(signal_handler *const handler, timer *const timer) {
+int signal_handler_process(signal_handler *const handler) {
     signal_info info;
     const ssize_t bytes_read = read(handler->fd, &info, sizeof(info));
     if (bytes_read == -1) {
@@ -93,18 +106,15 @@ int signal_handler_process(signal_handler *const handler, timer *const timer) {
 
     const int signal = (int)info.ssi_signo;
     switch (signal) {
-        case TIMER_SIGNAL:
-            if (handler->timer_callback(handler->blocks, handler->block_count,
-                                        timer) != 0) {
-                return 1;
-            }
-            return 0;
         case REFRESH_SIGNAL:
             if (handler->refresh_callback(handler->blocks,
                                           handler->block_count) != 0) {
                 return 1;
             }
             return 0;
+        case SIGCHLD:
+            reap_children(handler);
+            return 0;
         case SIGTERM:
             // fall through
         case SIGINT:
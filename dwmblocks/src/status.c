@@ -9,15 +9,16 @@
 #include "util.h"
 #include "x11.h"
 
-static bool has_status_changed(const status *const status) {
-    return strcmp(status->current, status->previous) != 0;
-}
-
-status status_new(const block *const blocks,
-                  const unsigned short block_count) {
+status status_new(block *const blocks, const unsigned short block_count) {
     status status = {
+#if TRAILING_DELIMITER
+        .current = DELIMITER,
+        .length = LEN(DELIMITER) - 1,
+#else
         .current = {[0] = '\0'},
-        .previous = {[0] = '\0'},
+        .length = 0,
+#endif
+        .offsets = {0},
 
         .blocks = blocks,
         .block_count = block_count,
@@ -26,51 +27,79 @@ status status_new(const block *const blocks,
     return status;
 }
 
-bool status_update(status *const status) {
-    (void)strncpy(status->previous, status->current, LEN(status->current));
-    status->current[0] = '\0';
-
-    for (unsigned short i = 0; i < status->block_count; ++i) {
-        const block *const block = &status->blocks[i];
+static size_t render_segment(const block *const block, char *const segment) {
+    size_t length = 0;
+    const size_t output_length = strlen(block->output);
+    if (output_length == 0) {
+        return length;
+    }
 
-        if (strlen(block->output) > 0) {
-#if LEADING_DELIMITER
-            (void)strncat(status->current, DELIMITER, LEN(DELIMITER));
-#else
-            if (status->current[0] != '\0') {
-                (void)strncat(status->current, DELIMITER, LEN(DELIMITER));
-            }
-#endif
+    (void)memcpy(segment, DELIMITER, LEN(DELIMITER) - 1);
+    length += LEN(DELIMITER) - 1;
 
 #if CLICKABLE_BLOCKS
-            if (block->signal > 0) {
-                const char signal[] = {(char)block->signal, '\0'};
-                (void)strncat(status->current, signal, LEN(signal));
-            }
+    if (block->signal > 0) {
+        segment[length++] = (char)block->signal;
+    }
 #endif
 
-            (void)strncat(status->current, block->icon, LEN(block->output));
-            (void)strncat(status->current, block->output, LEN(block->output));
-        }
-    }
+    const size_t icon_length = strlen(block->icon);
+    (void)memcpy(segment + length, block->icon, icon_length);
+    length += icon_length;
 
-#if TRAILING_DELIMITER
-    if (status->current[0] != '\0') {
-        (void)strncat(status->current, DELIMITER, LEN(DELIMITER));
+    (void)memcpy(segment + length, block->output, output_length);
+    length += output_length;
+
+    return length;
+}
+
+// Only the segments of changed blocks are rewritten; the rest of the status
+// is shifted when a segment's length changes.
+bool status_update(status *const status) {
+    bool has_changed = false;
+
+    for (unsigned short i = 0; i < status->block_count; ++i) {
+        block *const block = &status->blocks[i];
+        if (!block->has_changed) {
+            continue;
+        }
+        block->has_changed = false;
+        has_changed = true;
+
+        char segment[SEGMENT_LENGTH + ICONS_LENGTH];
+        const size_t length = render_segment(block, segment);
+        const size_t start = status->offsets[i];
+        const size_t end = status->offsets[i + 1];
+        if (length != end - start) {
+            (void)memmove(status->current + start + length,
+                          status->current + end, status->length - end + 1);
+            for (unsigned short j = i + 1; j <= status->block_count; ++j) {
+                status->offsets[j] = status->offsets[j] - end + start + length;
+            }
+            status->length = status->length - end + start + length;
+        }
+        (void)memcpy(status->current + start, segment, length);
     }
-#endif
 
-    return has_status_changed(status);
+    return has_changed;
 }
 
 int status_write(const status *const status, const bool is_debug_mode,
                  x11_connection *const connection) {
+    const char *text = "";
+    if (status->offsets[status->block_count] > 0) {
+        text = status->current;
+#if !LEADING_DELIMITER
+        text += LEN(DELIMITER) - 1;
+#endif
+    }
+
     if (is_debug_mode) {
-        (void)printf("%s\n", status->current);
+        (void)printf("%s\n", text);
         return 0;
     }
 
-    if (x11_set_root_name(connection, status->current) != 0) {
+    if (x11_set_root_name(connection, text) != 0) {
         return 1;
     }
 
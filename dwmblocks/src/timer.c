@@ -1,72 +1,210 @@
 #include "timer.h"
 
-#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "block.h"
 #include "util.h"
 
-static unsigned int compute_tick(const block *const blocks,
-                                 const unsigned short block_count) {
-    unsigned int tick = 0;
+// Deadline of running streams, which the timer never wakes up for.
+#define NEVER UINT64_MAX
 
-    for (unsigned short i = 0; i < block_count; ++i) {
-        const block *const block = &blocks[i];
-        tick = gcd(block->interval, tick);
-    }
+#define MILLISECONDS_PER_SECOND 1000
+#define NANOSECONDS_PER_MILLISECOND 1000000
+
+static uint64_t now(void) {
+    struct timespec time;
+    (void)clock_gettime(CLOCK_MONOTONIC, &time);
 
-    return tick;
+    return (uint64_t)time.tv_sec * MILLISECONDS_PER_SECOND +
+           (uint64_t)time.tv_nsec / NANOSECONDS_PER_MILLISECOND;
 }
 
-static unsigned int compute_reset_value(const block *const blocks,
-                                        const unsigned short block_count) {
-    unsigned int reset_value = 1;
+static bool is_earlier(const timer *const timer, const unsigned short a,
+                       const unsigned short b) {
+    return timer->deadlines[timer->heap[a]] < timer->deadlines[timer->heap[b]];
+}
 
-    for (unsigned short i = 0; i < block_count; ++i) {
-        const block *const block = &blocks[i];
-        reset_value = MAX(block->interval, reset_value);
-    }
+static void swap(timer *const timer, const unsigned short a,
+                 const unsigned short b) {
+    const unsigned short temp = timer->heap[a];
+    timer->heap[a] = timer->heap[b];
+    timer->heap[b] = temp;
+}
+
+static void sift_up(timer *const timer, unsigned short i) {
+    while (i > 0) {
+        const unsigned short parent = (i - 1) / 2;
+        if (!is_earlier(timer, i, parent)) {
+            break;
+        }
 
-    return reset_value;
+        swap(timer, i, parent);
+        i = parent;
+    }
 }
 
-timer timer_new(const block *const blocks, const unsigned short block_count) {
-    const unsigned int reset_value = compute_reset_value(blocks, block_count);
+static void sift_down(timer *const timer, unsigned short i) {
+    for (;;) {
+        const unsigned short left = 2 * i + 1;
+        const unsigned short right = left + 1;
+        unsigned short earliest = i;
+        if (left < timer->heap_size && is_earlier(timer, left, earliest)) {
+            earliest = left;
+        }
+        if (right < timer->heap_size && is_earlier(timer, right, earliest)) {
+            earliest = right;
+        }
+        if (earliest == i) {
+            break;
+        }
+
+        swap(timer, i, earliest);
+        i = earliest;
+    }
+}
 
+timer timer_new(block *const blocks, const unsigned short block_count) {
     timer timer = {
-        .time = reset_value,  // Initial value to execute all blocks.
-        .tick = compute_tick(blocks, block_count),
-        .reset_value = reset_value,
+        .fd = -1,
+
+        .blocks = blocks,
+        .block_count = block_count,
+
+        .heap_size = 0,
     };
 
     return timer;
 }
 
-int timer_arm(timer *const timer) {
-    errno = 0;
-    (void)alarm(timer->tick);
+// Sleep until the earliest deadline, or forever without one.
+static int timer_arm(timer *const timer) {
+    struct itimerspec value = {0};
+    if (timer->heap_size > 0 && timer->deadlines[timer->heap[0]] != NEVER) {
+        const uint64_t deadline = timer->deadlines[timer->heap[0]];
+        value.it_value.tv_sec = (time_t)(deadline / MILLISECONDS_PER_SECOND);
+        value.it_value.tv_nsec = (long)(deadline % MILLISECONDS_PER_SECOND) *
+                                 NANOSECONDS_PER_MILLISECOND;
+    }
 
-    if (errno != 0) {
+    if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &value, NULL) != 0) {
         (void)fprintf(stderr, "error: could not arm timer\n");
         return 1;
     }
 
-    // Wrap `time` to the interval [1, reset_value].
-    timer->time = (timer->time + timer->tick) % timer->reset_value;
+    return 0;
+}
+
+int timer_init(timer *const timer) {
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd == -1) {
+        (void)fprintf(stderr, "error: could not create timer\n");
+        return 1;
+    }
+
+    // Blocks are run once at startup, so the first updates are an interval
+    // away.
+    const uint64_t time = now();
+    for (unsigned short i = 0; i < timer->block_count; ++i) {
+        const block *const block = &timer->blocks[i];
+        if (block->interval == 0) {
+            continue;
+        }
+
+        // Streams are started with the other blocks and only need the timer
+        // to restart them.
+        timer->deadlines[i] =
+            block_is_stream(block)
+                ? NEVER
+                : time + (uint64_t)block->interval * MILLISECONDS_PER_SECOND;
+        timer->starts[i] = time;
+        timer->restart_delays[i] = STREAM_MIN_BACKOFF;
+        timer->heap[timer->heap_size] = i;
+        sift_up(timer, timer->heap_size);
+        ++timer->heap_size;
+    }
+
+    return timer_arm(timer);
+}
+
+int timer_deinit(timer *const timer) {
+    if (close(timer->fd) != 0) {
+        (void)fprintf(stderr, "error: could not close timer file descriptor\n");
+        return 1;
+    }
 
     return 0;
 }
 
-bool timer_must_run_block(const timer *const timer, const block *const block) {
-    if (timer == NULL || timer->time == timer->reset_value) {
-        return true;
+int timer_process(timer *const timer) {
+    uint64_t expirations;
+    if (read(timer->fd, &expirations, sizeof(expirations)) == -1) {
+        return 0;
     }
 
-    if (block->interval == 0) {
-        return false;
+    // Blocks due within the slack are run now, to batch wakeups.
+    const uint64_t time = now();
+    while (timer->heap_size > 0 &&
+           timer->deadlines[timer->heap[0]] <= time + TIMER_SLACK) {
+        const unsigned short i = timer->heap[0];
+        block *const block = &timer->blocks[i];
+        if (block_execute(block, 0) != 0) {
+            return 1;
+        }
+
+        if (block_is_stream(block)) {
+            timer->starts[i] = time;
+            timer->deadlines[i] = NEVER;
+            sift_down(timer, 0);
+            continue;
+        }
+
+        // Skip updates missed while the process was stopped.
+        const uint64_t interval =
+            (uint64_t)block->interval * MILLISECONDS_PER_SECOND;
+        timer->deadlines[i] += interval;
+        if (timer->deadlines[i] <= time) {
+            timer->deadlines[i] = time + interval;
+        }
+        sift_down(timer, 0);
+    }
+
+    return timer_arm(timer);
+}
+
+// Streams that have ended are restarted after their backoff.
+int timer_schedule_restarts(timer *const timer) {
+    bool has_changed = false;
+    uint64_t time = 0;
+    for (unsigned short i = 0; i < timer->heap_size; ++i) {
+        const unsigned short j = timer->heap[i];
+        const block *const block = &timer->blocks[j];
+        if (!block_is_stream(block) || block_is_running(block) ||
+            timer->deadlines[j] != NEVER) {
+            continue;
+        }
+
+        if (!has_changed) {
+            time = now();
+            has_changed = true;
+        }
+
+        // A stream that ran for a while has recovered.
+        if (time - timer->starts[j] >=
+            (uint64_t)STREAM_MAX_BACKOFF * MILLISECONDS_PER_SECOND) {
+            timer->restart_delays[j] = STREAM_MIN_BACKOFF;
+        }
+
+        timer->deadlines[j] = time + (uint64_t)timer->restart_delays[j] *
+                                         MILLISECONDS_PER_SECOND;
+        timer->restart_delays[j] =
+            MIN(timer->restart_delays[j] * 2, STREAM_MAX_BACKOFF);
+        sift_up(timer, i);
     }
 
-    return timer->time % block->interval == 0;
+    return has_changed ? timer_arm(timer) : 0;
 }
@@ -2,16 +2,6 @@
 
 #define UTF8_MULTIBYTE_BIT BIT(7)
 
-unsigned int gcd(unsigned int a, unsigned int b) {
-    while (b > 0) {
-        const unsigned int temp = a % b;
-        a = b;
-        b = temp;
-    }
-
-    return a;
-}
-
 size_t truncate_utf8_string(char* const buffer, const size_t size,
                             const size_t char_limit) {
     size_t char_count = 0;
@@ -0,0 +1,300 @@
+#include "watch-source.h"
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "main.h"
+#include "util.h"
+
+#define INOTIFY_MASK                                                  \
+    (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | \
+     IN_MOVED_FROM)
+#define UEVENT_GROUP 1
+
+watch_source watch_source_new(block* const blocks,
+                              const unsigned short block_count) {
+#define WATCH(signal, source) \
+    {signal, source, -1, NULL},
+    watch_source source = {
+        .inotify_fd = -1,
+        .route_fd = -1,
+        .uevent_fd = -1,
+
+        .blocks = blocks,
+        .block_count = block_count,
+        .watches = {WATCHES(WATCH){0, NULL, -1, NULL}},
+    };
+#undef WATCH
+
+    return source;
+}
+
+static bool is_netlink_source(const watch* const watch) {
+    return strcmp(watch->source, NETLINK_LINK_SOURCE) == 0 ||
+           strcmp(watch->source, NETLINK_ADDRESS_SOURCE) == 0;
+}
+
+static bool is_uevent_source(const watch* const watch) {
+    return strncmp(watch->source, UEVENT_SOURCE_PREFIX,
+                   LEN(UEVENT_SOURCE_PREFIX) - 1) == 0;
+}
+
+static int open_netlink(const int protocol, const unsigned int groups) {
+    const int fd =
+        socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if (fd == -1) {
+        return -1;
+    }
+
+    const struct sockaddr_nl address = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = groups,
+    };
+    if (bind(fd, (const struct sockaddr*)&address, sizeof(address)) != 0) {
+        (void)close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Only a malformed path is an error, a directory that can't be watched
+// just leaves its blocks to their interval and signal.
+static int add_inotify_watch(watch_source* const source, watch* const watch) {
+    // A trailing slash watches everything in the directory.
+    char directory[4096];
+    const char* const slash = strrchr(watch->source, '/');
+    if (watch->source[0] != '/' ||
+        (size_t)(slash - watch->source) >= LEN(directory)) {
+        (void)fprintf(stderr, "error: \"%s\" is not an absolute path\n",
+                      watch->source);
+        return 1;
+    }
+    const size_t length = slash == watch->source ? 1 : slash - watch->source;
+    (void)memcpy(directory, watch->source, length);
+    directory[length] = '\0';
+    watch->name = slash[1] == '\0' ? NULL : slash + 1;
+
+    if (source->inotify_fd == -1) {
+        source->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (source->inotify_fd == -1) {
+            (void)fprintf(stderr,
+                          "warning: could not initialize inotify for \"%s\"\n",
+                          watch->source);
+            return 0;
+        }
+    }
+
+    watch->descriptor =
+        inotify_add_watch(source->inotify_fd, directory, INOTIFY_MASK);
+    if (watch->descriptor == -1) {
+        (void)fprintf(stderr, "warning: could not watch \"%s\"\n", directory);
+    }
+
+    return 0;
+}
+
+int watch_source_init(watch_source* const source) {
+    for (watch* watch = source->watches; watch->source != NULL; ++watch) {
+        if (watch->signal <= 0) {
+            (void)fprintf(stderr,
+                          "error: \"%s\" watch source needs a block signal\n",
+                          watch->source);
+            return 1;
+        }
+
+        if (is_netlink_source(watch)) {
+            if (source->route_fd != -1) {
+                continue;
+            }
+
+            source->route_fd =
+                open_netlink(NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR |
+                                                RTMGRP_IPV6_IFADDR);
+            if (source->route_fd == -1) {
+                (void)fprintf(stderr,
+                              "warning: could not listen to link events\n");
+            }
+        } else if (is_uevent_source(watch)) {
+            if (source->uevent_fd != -1) {
+                continue;
+            }
+
+            source->uevent_fd =
+                open_netlink(NETLINK_KOBJECT_UEVENT, UEVENT_GROUP);
+            if (source->uevent_fd == -1) {
+                (void)fprintf(stderr,
+                              "warning: could not listen to device events\n");
+            }
+        } else if (add_inotify_watch(source, watch) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int watch_source_deinit(watch_source* const source) {
+    int status = 0;
+    const int fds[] = {source->inotify_fd, source->route_fd,
+                       source->uevent_fd};
+    for (unsigned short i = 0; i < LEN(fds); ++i) {
+        if (fds[i] != -1 && close(fds[i]) != 0) {
+            (void)fprintf(stderr,
+                          "error: could not close watch file descriptor\n");
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+static void trigger(const watch_source* const source, const int signal,
+                    bool* const is_triggered) {
+    for (unsigned short i = 0; i < source->block_count; ++i) {
+        if (source->blocks[i].signal == signal) {
+            is_triggered[i] = true;
+        }
+    }
+}
+
+static void process_inotify(const watch_source* const source,
+                            bool* const is_triggered) {
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    ssize_t bytes_read;
+    while ((bytes_read = read(source->inotify_fd, &buffer, sizeof(buffer))) >
+           0) {
+        for (const char* cursor = buffer.bytes;
+             cursor < buffer.bytes + bytes_read;) {
+            const struct inotify_event* const event =
+                (const struct inotify_event*)cursor;
+            cursor += sizeof(*event) + event->len;
+
+            for (const watch* watch = source->watches; watch->source != NULL;
+                 ++watch) {
+                if (watch->descriptor != event->wd) {
+                    continue;
+                }
+                if (watch->name == NULL ||
+                    (event->len > 0 && strcmp(event->name, watch->name) == 0)) {
+                    trigger(source, watch->signal, is_triggered);
+                }
+            }
+        }
+    }
+}
+
+static void process_route(const watch_source* const source,
+                          bool* const is_triggered) {
+    union {
+        struct nlmsghdr header;
+        char bytes[8192];
+    } buffer;
+
+    ssize_t bytes_read;
+    while ((bytes_read = recv(source->route_fd, &buffer, sizeof(buffer), 0)) !=
+           0) {
+        bool has_link = false;
+        bool has_address = false;
+
+        // Lost messages could have been anything.
+        if (bytes_read == -1) {
+            if (errno != ENOBUFS) {
+                break;
+            }
+            has_link = has_address = true;
+        }
+
+        size_t length = bytes_read > 0 ? (size_t)bytes_read : 0;
+        for (const struct nlmsghdr* header = &buffer.header;
+             NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            switch (header->nlmsg_type) {
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                    has_link = true;
+                    break;
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                    has_address = true;
+                    break;
+            }
+        }
+
+        for (const watch* watch = source->watches; watch->source != NULL;
+             ++watch) {
+            if ((has_link && strcmp(watch->source, NETLINK_LINK_SOURCE) == 0) ||
+                (has_address &&
+                 strcmp(watch->source, NETLINK_ADDRESS_SOURCE) == 0)) {
+                trigger(source, watch->signal, is_triggered);
+            }
+        }
+    }
+}
+
+static void process_uevent(const watch_source* const source,
+                           bool* const is_triggered) {
+    char buffer[8192];
+
+    ssize_t bytes_read;
+    while ((bytes_read = recv(source->uevent_fd, buffer, sizeof(buffer) - 1,
+                              0)) > 0) {
+        buffer[bytes_read] = '\0';
+
+        // The header is followed by NUL-separated KEY=VALUE pairs.
+        const char* subsystem = NULL;
+        for (const char* cursor = buffer; cursor < buffer + bytes_read;
+             cursor += strlen(cursor) + 1) {
+            if (strncmp(cursor, "SUBSYSTEM=", 10) == 0) {
+                subsystem = cursor + 10;
+                break;
+            }
+        }
+        if (subsystem == NULL) {
+            continue;
+        }
+
+        for (const watch* watch = source->watches; watch->source != NULL;
+             ++watch) {
+            if (is_uevent_source(watch) &&
+                strcmp(watch->source + LEN(UEVENT_SOURCE_PREFIX) - 1,
+                       subsystem) == 0) {
+                trigger(source, watch->signal, is_triggered);
+            }
+        }
+    }
+}
+
+int watch_source_process(watch_source* const source) {
+    // Bursts of events refresh each block only once.
+    bool is_triggered[BLOCK_COUNT] = {false};
+
+    if (source->inotify_fd != -1) {
+        process_inotify(source, is_triggered);
+    }
+    if (source->route_fd != -1) {
+        process_route(source, is_triggered);
+    }
+    if (source->uevent_fd != -1) {
+        process_uevent(source, is_triggered);
+    }
+
+    for (unsigned short i = 0; i < source->block_count; ++i) {
+        if (is_triggered[i] && block_execute(&source->blocks[i], 0) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
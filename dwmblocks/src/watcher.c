@@ -7,13 +7,17 @@
 
 #include "block.h"
 #include "util.h"
+#include "watch-source.h"
 
 static bool watcher_fd_is_readable(const watcher_fd* const watcher_fd) {
-    return (watcher_fd->revents & POLLIN) != 0;
+    // A block's pipe may only report the hangup at the end of its output.
+    return (watcher_fd->revents & (POLLIN | POLLHUP)) != 0;
 }
 
 int watcher_init(watcher* const watcher, const block* const blocks,
-                 const unsigned short block_count, const int signal_fd) {
+                 const unsigned short block_count, const int signal_fd,
+                 const int timer_fd, const int x11_fd,
+                 const watch_source* const source) {
     if (signal_fd == -1) {
         (void)fprintf(
             stderr,
@@ -25,17 +29,25 @@ int watcher_init(watcher* const watcher, const block* const blocks,
     fd->fd = signal_fd;
     fd->events = POLLIN;
 
-    for (unsigned short i = 0; i < block_count; ++i) {
-        const int block_fd = blocks[i].pipe[READ_END];
-        if (block_fd == -1) {
-            (void)fprintf(
-                stderr,
-                "error: invalid block file descriptors passed to watcher\n");
-            return 1;
-        }
+    watcher->fds[TIMER_FD].fd = timer_fd;
+    watcher->fds[TIMER_FD].events = POLLIN;
+
+    watcher->fds[X11_FD].fd = x11_fd;
+    watcher->fds[X11_FD].events = POLLIN;
+
+    // Unused watch sources stay at -1.
+    watcher->fds[INOTIFY_FD].fd = source->inotify_fd;
+    watcher->fds[ROUTE_FD].fd = source->route_fd;
+    watcher->fds[UEVENT_FD].fd = source->uevent_fd;
+    for (unsigned short i = INOTIFY_FD; i <= UEVENT_FD; ++i) {
+        watcher->fds[i].events = POLLIN;
+    }
 
+    // Block pipes only exist while their commands run, see watcher_poll().
+    watcher->blocks = blocks;
+    for (unsigned short i = 0; i < block_count; ++i) {
         watcher_fd* const fd = &watcher->fds[i];
-        fd->fd = block_fd;
+        fd->fd = -1;
         fd->events = POLLIN;
     }
 
@@ -43,6 +55,11 @@ int watcher_init(watcher* const watcher, const block* const blocks,
 }
 
 int watcher_poll(watcher* watcher, const int timeout_ms) {
+    // Negative descriptors of idle blocks are ignored by poll().
+    for (unsigned short i = 0; i < BLOCK_COUNT; ++i) {
+        watcher->fds[i].fd = watcher->blocks[i].fd;
+    }
+
     int event_count = poll(watcher->fds, LEN(watcher->fds), timeout_ms);
 
     // Don't return non-zero status for signal interruptions.
@@ -52,18 +69,21 @@ int watcher_poll(watcher* watcher, const int timeout_ms) {
     }
 
     watcher->got_signal = watcher_fd_is_readable(&watcher->fds[SIGNAL_FD]);
+    watcher->got_timer = watcher_fd_is_readable(&watcher->fds[TIMER_FD]);
+    watcher->got_x11_event = watcher_fd_is_readable(&watcher->fds[X11_FD]);
+    watcher->got_watch_event =
+        watcher_fd_is_readable(&watcher->fds[INOTIFY_FD]) ||
+        watcher_fd_is_readable(&watcher->fds[ROUTE_FD]) ||
+        watcher_fd_is_readable(&watcher->fds[UEVENT_FD]);
 
-    watcher->active_block_count = event_count - (int)watcher->got_signal;
     unsigned short i = 0;
-    unsigned short j = 0;
-    while (i < event_count && j < LEN(watcher->active_blocks)) {
+    for (unsigned short j = 0; i < event_count && j < BLOCK_COUNT; ++j) {
         if (watcher_fd_is_readable(&watcher->fds[j])) {
             watcher->active_blocks[i] = j;
             ++i;
         }
-
-        ++j;
     }
+    watcher->active_block_count = i;
 
     return 0;
 }
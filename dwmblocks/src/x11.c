@@ -1,6 +1,7 @@
 #include "x11.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
@@ -19,24 +20,40 @@ void x11_connection_close(xcb_connection_t *const connection) {
     xcb_disconnect(connection);
 }
 
+int x11_connection_fd(x11_connection *const connection) {
+    return xcb_get_file_descriptor(connection);
+}
+
 int x11_set_root_name(x11_connection *const connection, const char *name) {
     xcb_screen_t *const screen =
         xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
     const xcb_window_t root_window = screen->root;
 
+    // Don't wait for a reply, errors are reported by x11_process_events().
     const unsigned short name_format = 8;
-    const xcb_void_cookie_t cookie = xcb_change_property(
-        connection, XCB_PROP_MODE_REPLACE, root_window, XCB_ATOM_WM_NAME,
-        XCB_ATOM_STRING, name_format, strlen(name), name);
+    (void)xcb_change_property(connection, XCB_PROP_MODE_REPLACE, root_window,
+                              XCB_ATOM_WM_NAME, XCB_ATOM_STRING, name_format,
+                              strlen(name), name);
 
-    xcb_generic_error_t *error = xcb_request_check(connection, cookie);
-    if (error != NULL) {
-        (void)fprintf(stderr, "error: could not set X root name\n");
+    if (xcb_flush(connection) <= 0) {
+        (void)fprintf(stderr, "error: could not flush X output buffer\n");
         return 1;
     }
 
-    if (xcb_flush(connection) <= 0) {
-        (void)fprintf(stderr, "error: could not flush X output buffer\n");
+    return 0;
+}
+
+int x11_process_events(x11_connection *const connection) {
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(connection)) != NULL) {
+        if (event->response_type == 0) {
+            (void)fprintf(stderr, "error: could not set X root name\n");
+        }
+        free(event);
+    }
+
+    if (xcb_connection_has_error(connection)) {
+        (void)fprintf(stderr, "error: lost connection to X server\n");
         return 1;
     }
 
@@ -0,0 +1,106 @@
+/* See LICENSE for license details. */
+
+/*
+ * Headless parser throughput: reads a file from stdin and feeds it through
+ * twrite() on a terminal without a window, e.g.
+ *
+ *	make bench && ./bench 200 60 < big.log
+ *
+ * The file should not hold queries such as DA, whose answers st would try
+ * to write to the tty.
+ */
+#include "st.c"
+
+/* the settings st.c takes from config.h, as in config.def.h */
+char *argv0;
+char *externalpipe_sigusr1[] = {"/bin/sh", "-c", "true"};
+char *utmp = NULL;
+char *scroll = NULL;
+char *stty_args = "stty raw pass8 nl -echo -iexten -cstopb 38400";
+char *vtiden = "\033[?6c";
+wchar_t *worddelimiters = L" `'\"()[]{}";
+int allowaltscreen = 1;
+int allowwindowops = 0;
+unsigned int histsize = 2000;
+int histcompact = 1;
+unsigned int ttybufsize = 256 * 1024;
+unsigned int ttyreadmax = 4 * 1024 * 1024;
+unsigned int ttyreadtime = 8;
+char *termname = "st-256color";
+unsigned int tabspaces = 8;
+unsigned int defaultfg = 259;
+unsigned int defaultbg = 258;
+unsigned int defaultcs = 256;
+char *iso14755_cmd = "true";
+char *urlhandler = "true";
+char urlchars[] = "";
+char *urlprefixes[] = {NULL};
+
+int isboxdraw(Rune u) { return 0; }
+void toggle_winmode(int flag) {}
+void xbell(void) {}
+void xclearwin(void) {}
+void xclipcopy(void) {}
+void xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og) {}
+void xdrawline(Line line, int x1, int y1, int x2) {}
+void xfinishdraw(void) {}
+void xfreetitlestack(void) {}
+int xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b) { return 1; }
+void xloadcols(void) {}
+void xpushtitle(void) {}
+int xsetcolorname(int x, const char *name) { return 1; }
+int xsetcursor(int cursor) { return 0; }
+void xseticontitle(char *p) {}
+void xsetmode(int set, unsigned int flags) {}
+void xsetpointermotion(int set) {}
+void xsetsel(char *str) {}
+void xsettitle(char *p, int pop) {}
+int xstartdraw(void) { return 0; }
+void xximspot(int x, int y) {}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	char *buf = NULL;
+	size_t len = 0, siz = 0, off = 0, n;
+	ssize_t ret;
+	long ms;
+	int col = 80, row = 24;
+
+	if (argc == 3) {
+		col = atoi(argv[1]);
+		row = atoi(argv[2]);
+	}
+
+	/* read everything first, so only the parser is timed */
+	do {
+		if (len == siz) {
+			siz = siz ? siz * 2 : BUFSIZ;
+			buf = xrealloc(buf, siz);
+		}
+		ret = read(STDIN_FILENO, buf + len, siz - len);
+		if (ret < 0)
+			die("read: %s\n", strerror(errno));
+		len += ret;
+	} while (ret > 0);
+
+	tnew(MAX(col, 1), MAX(row, 1));
+	selinit();
+
+	/* in pieces of the largest tty read, keeping split UTF-8 sequences */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (off < len) {
+		n = MIN(len - off, ttybufsize);
+		n = twrite(buf + off, n, 0);
+		if (n == 0)
+			break;
+		off += n;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = MAX(TIMEDIFF(end, start), 1);
+	printf("%zu bytes in %ld ms, %.1f MB/s\n", off, ms, off / 1000.0 / ms);
+
+	return 0;
+}
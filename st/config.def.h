@@ -86,6 +86,19 @@ static unsigned int tripleclicktimeout = 600;
 /* Alt screens */
 int allowaltscreen = 1;
 
+/*
+ * Lines of scrollback history. Lines are only allocated as they scroll off
+ * the screen and are stored without their trailing blanks.
+ */
+unsigned int histsize = 2000;
+
+/*
+ * 1: store history lines as runes plus runs of shared attributes, which
+ *    takes a fraction of the memory of full glyphs for typical output.
+ * 0: store history lines as plain glyphs.
+ */
+int histcompact = 1;
+
 /* Allow certain non-interactive (insecure) window operations such as:
    setting the clipboard text */
 int allowwindowops = 0;
@@ -99,6 +112,15 @@ int allowwindowops = 0;
 static double minlatency = 8;
 static double maxlatency = 33;
 
+/*
+ * Reading from the tty: the read buffer grows up to ttybufsize bytes under
+ * heavy output. A single drain parses at most ttyreadmax bytes or runs for
+ * at most ttyreadtime ms before st handles X events and draws again.
+ */
+unsigned int ttybufsize = 256 * 1024;
+unsigned int ttyreadmax = 4 * 1024 * 1024;
+unsigned int ttyreadtime = 8;
+
 /*
  * Blinking timeout (set to 0 to disable blinking) for the terminal blinking
  * attribute.
@@ -242,6 +264,7 @@ ResourcePref resources[] = {
   { "blinktimeout", INTEGER, &blinktimeout },
   { "bellvolume",   INTEGER, &bellvolume },
   { "tabspaces",    INTEGER, &tabspaces },
+  { "histsize",     INTEGER, &histsize },
   { "borderpx",     INTEGER, &borderpx },
   { "cwscale",      FLOAT,   &cwscale },
   { "chscale",      FLOAT,   &chscale },
@@ -393,6 +416,7 @@ static Shortcut shortcuts[] = {
   // PRINTERS
   { ALTKEY,               XK_Print,       printsel,       {.i =  0} },
   { ShiftMask,            XK_Print,       printscreen,    {.i =  0} },
+  { ALTMOD,               XK_Print,       printstats,     {.i =  0} },
   { ControlMask,          XK_Print,       toggleprinter,  {.i =  0} },
 
   // TERMINAL
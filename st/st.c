@@ -14,6 +14,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <X11/keysym.h>
@@ -33,6 +34,12 @@ extern char *argv0;
  #include <libutil.h>
 #endif
 
+#if   defined(__AVX2__)
+ #include <immintrin.h>
+#elif defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
 /* Arbitrary sizes */
 #define UTF_INVALID   0xFFFD
 #define UTF_SIZ       4
@@ -40,7 +47,6 @@ extern char *argv0;
 #define ESC_ARG_SIZ   16
 #define STR_BUF_SIZ   ESC_BUF_SIZ
 #define STR_ARG_SIZ   ESC_ARG_SIZ
-#define HISTSIZE      2000
 
 /* macros */
 #define IS_SET(flag)		((term.mode & (flag)) != 0)
@@ -50,10 +56,15 @@ extern char *argv0;
 #define ISDELIM(u)		(u && wcschr(worddelimiters, u))
 #define STRESCARGREST(n)	((n) == 0 ? strescseq.buf : strescseq.argp[(n)-1] + 1)
 #define STRESCARGJUST(n)	(*(strescseq.argp[n]) = '\0', STRESCARGREST(n))
-#define TLINE(y)		((y) < term.scr ? term.hist[((y) + term.histi - \
-            term.scr + HISTSIZE + 1) % HISTSIZE] : \
+#define TLINE(y)		((y) < term.scr ? thistline(y) : \
             term.line[(y) - term.scr])
-#define TLINE_HIST(y)           ((y) <= HISTSIZE-term.row+2 ? term.hist[(y)] : term.line[(y-HISTSIZE+term.row-3)])
+#define HLGLYPHS(hl)		((Glyph *)(hl)->data)
+#define HLRUNS(hl)		((AttrRun *)(hl)->data)
+#define HLRUNES(hl)		((void *)(HLRUNS(hl) + (hl)->nrun))
+#define HISTATTRCMP(a, b)	((((a).mode ^ (b).mode) & ~ATTR_URL) || \
+            (a).fg != (b).fg || (a).bg != (b).bg)
+#define ISBLANK(g)		((g).u == ' ' && !(g).mode && \
+            (g).fg == defaultfg && (g).bg == defaultbg)
 
 enum term_mode {
 	MODE_WRAP        = 1 << 0,
@@ -121,6 +132,36 @@ typedef struct {
 	int alt;
 } Selection;
 
+/* Glyphs of a history line sharing the same attributes */
+typedef struct {
+	ushort len;   /* nb of glyphs in the run */
+	ushort mode;  /* attribute flags */
+	uint32_t fg;  /* foreground  */
+	uint32_t bg;  /* background  */
+} AttrRun;
+
+/*
+ * A line which scrolled off the screen, trailing blanks stripped. With
+ * histcompact it holds nrun attribute runs followed by the runes, packed
+ * in a byte each unless wide is set. Otherwise it holds plain glyphs.
+ */
+typedef struct {
+	int len;      /* nb of glyphs stored */
+	int nrun;     /* nb of attribute runs, -1 for plain glyphs */
+	int wide;     /* runes are stored as Rune instead of uchar */
+	uint32_t data[];
+} HistLine;
+
+/* URLs found in a row of the view */
+typedef struct {
+	uint32_t hash; /* of the runes the URLs were searched in */
+	int n;         /* nb of URLs, -1 if not searched yet */
+	int cap;
+	struct {
+		int b, e; /* first and past-the-end column */
+	} *url;
+} URLLine;
+
 /* Internal representation of the screen */
 typedef struct {
 	int row;      /* nb row */
@@ -128,8 +169,14 @@ typedef struct {
 	int maxcol;   /* maximum number of columns ever allocated */
 	Line *line;   /* screen */
 	Line *alt;    /* alternate screen */
-	Line hist[HISTSIZE]; /* history buffer */
-	int histi;    /* history index */
+	HistLine **hist; /* history ring, grown as lines scroll in */
+	int histcap;  /* nb of allocated history slots */
+	int histn;    /* nb of lines in history */
+	int histi;    /* history slot written next */
+	ulong histseq; /* nb of lines ever pushed to history */
+	Line *view;   /* history lines expanded for display, one per row */
+	ulong *viewseq; /* history line held by each view row, plus one */
+	URLLine *urls; /* URLs in each row of the view */
 	int scr;      /* scroll back */
 	int *dirty;   /* dirtyness of lines */
 	TCursor c;    /* cursor */
@@ -168,11 +215,6 @@ typedef struct {
 	int narg;              /* nb of args */
 } STREscape;
 
-typedef struct {
-	int state;
-	size_t length;
-} URLdfa;
-
 static void execsh(char *, char **);
 static int chdir_by_pid(pid_t pid);
 static void stty(char **);
@@ -195,6 +237,7 @@ static void tprinter(char *, size_t);
 static void tdumpsel(void);
 static void tdumpline(int);
 static void tdump(void);
+static size_t texport(char **, size_t *, int, int, int);
 static void tclearregion(int, int, int, int);
 static void tcursor(int);
 static void tdeletechar(int);
@@ -202,11 +245,18 @@ static void tdeleteline(int);
 static void tinsertblank(int);
 static void tinsertblankline(int);
 static int tlinelen(int);
+static Line thistline(int);
+static void thistexpand(const HistLine *, Line);
+static void thiststore(HistLine **, const Line);
+static void thistpush(const Line);
+static void thistreplace(const Line);
 static void tmoveto(int, int);
 static void tmoveato(int, int);
 static void tnewline(int);
 static void tputtab(int);
 static void tputc(Rune);
+static void tputascii(const char *, int);
+static int asciilen(const char *, int);
 static void treset(void);
 static void tscrollup(int, int, int);
 static void tscrolldown(int, int, int);
@@ -223,7 +273,8 @@ static void tdefutf8(char);
 static int32_t tdefcolor(const int *, int *, int);
 static void tdeftran(char);
 static void tstrsequence(uchar);
-static int daddch(URLdfa *, char);
+static URLLine *turls(int);
+static void turlmark(int, Line);
 
 static void drawregion(int, int, int, int);
 
@@ -250,6 +301,7 @@ static CSIEscape csiescseq;
 static STREscape strescseq;
 static int iofd = 1;
 static int cmdfd;
+static size_t ttybytes, ttyreads;
 static pid_t pid;
 
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
@@ -443,18 +495,142 @@ tlinelen(int y)
 	return i;
 }
 
-int
-tlinehistlen(int y)
+/*
+ * Returns history line y of the scrolled view. Stored lines are only as
+ * long as their content, so they are expanded into a per-row buffer which
+ * is reused until another history line shows up in that row.
+ */
+Line
+thistline(int y)
 {
-	int i = term.col;
+	ulong seq = term.histseq - term.scr + y;
+	Line line = term.view[y];
 
-	if (TLINE_HIST(y)[i - 1].mode & ATTR_WRAP)
-		return i;
+	if (term.viewseq[y] == seq + 1)
+		return line;
 
-	while (i > 0 && TLINE_HIST(y)[i - 1].u == ' ')
-		--i;
+	thistexpand(term.hist[(term.histi - (int)(term.histseq - seq)
+	                      + term.histcap) % term.histcap], line);
+	term.viewseq[y] = seq + 1;
 
-	return i;
+	return line;
+}
+
+void
+thistexpand(const HistLine *hl, Line line)
+{
+	const AttrRun *run;
+	const uchar *rb;
+	const Rune *rw;
+	int i, x;
+
+	if (hl->nrun < 0) {
+		memcpy(line, HLGLYPHS(hl), hl->len * sizeof(Glyph));
+	} else {
+		rb = HLRUNES(hl);
+		rw = HLRUNES(hl);
+		for (run = HLRUNS(hl), x = 0; run < HLRUNS(hl) + hl->nrun; run++) {
+			for (i = 0; i < run->len; i++, x++) {
+				line[x].u = hl->wide ? rw[x] : rb[x];
+				line[x].mode = run->mode;
+				line[x].fg = run->fg;
+				line[x].bg = run->bg;
+			}
+		}
+	}
+	for (x = hl->len; x < term.maxcol; x++)
+		line[x] = (Glyph){ .u = ' ', .fg = defaultfg, .bg = defaultbg };
+}
+
+void
+thiststore(HistLine **hlp, const Line line)
+{
+	HistLine *hl;
+	AttrRun *run;
+	uchar *rb;
+	Rune *rw;
+	int len = term.col, nrun = 0, wide = 0, x;
+
+	while (len > 0 && ISBLANK(line[len - 1]))
+		--len;
+
+	if (!histcompact) {
+		hl = *hlp = xrealloc(*hlp, sizeof(HistLine) + len * sizeof(Glyph));
+		hl->len = len;
+		hl->nrun = -1;
+		memcpy(HLGLYPHS(hl), line, len * sizeof(Glyph));
+		return;
+	}
+
+	/* URL highlighting is redone on every draw, so it doesn't split runs */
+	for (x = 0; x < len; x++) {
+		if (x == 0 || HISTATTRCMP(line[x], line[x-1]))
+			nrun++;
+		wide |= line[x].u > 0xFF;
+	}
+
+	hl = *hlp = xrealloc(*hlp, sizeof(HistLine) + nrun * sizeof(AttrRun)
+	                     + len * (wide ? sizeof(Rune) : 1));
+	hl->len = len;
+	hl->nrun = nrun;
+	hl->wide = wide;
+	rb = HLRUNES(hl);
+	rw = HLRUNES(hl);
+	for (x = 0, run = HLRUNS(hl); x < len; x++) {
+		if (x == 0 || HISTATTRCMP(line[x], line[x-1])) {
+			if (x > 0)
+				run++;
+			*run = (AttrRun){ .mode = line[x].mode & ~ATTR_URL,
+			                  .fg = line[x].fg, .bg = line[x].bg };
+		}
+		run->len++;
+		if (wide)
+			rw[x] = line[x].u;
+		else
+			rb[x] = line[x].u;
+	}
+}
+
+void
+thistpush(const Line line)
+{
+	if (!histsize)
+		return;
+
+	/*
+	 * The ring only overwrites lines once it holds histsize of them.
+	 * Until then a full ring is still in order from slot 0, with histi
+	 * just wrapped to 0, so it can grow in place and continue at histn.
+	 */
+	if (term.histn == term.histcap && term.histcap < histsize) {
+		term.histcap = MIN(MAX(term.histcap * 2, 64), histsize);
+		term.hist = xrealloc(term.hist,
+		                     term.histcap * sizeof(*term.hist));
+		memset(term.hist + term.histn, 0,
+		       (term.histcap - term.histn) * sizeof(*term.hist));
+		term.histi = term.histn;
+	}
+
+	thiststore(&term.hist[term.histi], line);
+	term.histi = (term.histi + 1) % term.histcap;
+	term.histn = MIN(term.histn + 1, term.histcap);
+	term.histseq++;
+}
+
+void
+thistreplace(const Line line)
+{
+	int i;
+
+	if (!term.histn) {
+		thistpush(line);
+		return;
+	}
+
+	thiststore(&term.hist[(term.histi - 1 + term.histcap) % term.histcap],
+	           line);
+	for (i = 0; i < term.row; i++)
+		term.viewseq[i] = 0;
 }
 
 void
@@ -675,90 +851,114 @@ getsel(void)
 	return str;
 }
 
-char *
-strstrany(char* s, char** strs) {
-	char *match;
-	for (int i = 0; strs[i]; i++) {
-		if ((match = strstr(s, strs[i]))) {
-			return match;
+/*
+ * Finds the URLs in row y of the view. Every byte has a class with bit 0
+ * set for urlchars and bit n+1 set when it starts urlprefixes[n], so a
+ * single pass over the row only compares prefixes where one can start.
+ * The result is kept until the runes of the row change.
+ */
+URLLine *
+turls(int y)
+{
+	static uint urlclass[128];
+	static int urlinit;
+	URLLine *ul = &term.urls[y];
+	Line line = TLINE(y);
+	uint32_t hash = 2166136261u;
+	uint c, m;
+	const char *pre;
+	int i, x, e;
+
+	if (!urlinit) {
+		for (pre = urlchars; *pre; pre++)
+			urlclass[*pre & 0x7f] |= 1;
+		for (i = 0; urlprefixes[i] && i < 31; i++)
+			urlclass[urlprefixes[i][0] & 0x7f] |= 1 << (i + 1);
+		urlinit = 1;
+	}
+
+	for (x = 0; x < term.col; x++)
+		hash = (hash ^ line[x].u) * 16777619u;
+	if (ul->n >= 0 && ul->hash == hash)
+		return ul;
+
+	ul->hash = hash;
+	ul->n = 0;
+	for (x = 0; x < term.col; x++) {
+		if (line[x].u >= 128 || !(m = urlclass[line[x].u] >> 1))
+			continue;
+		for (i = 0; m; i++, m >>= 1) {
+			if (!(m & 1))
+				continue;
+			for (pre = urlprefixes[i], e = x; *pre && e < term.col
+			     && line[e].u == (uchar)*pre; pre++, e++)
+				;
+			if (!*pre)
+				break;
 		}
-	}
-	return NULL;
-}
+		if (!m)
+			continue;
 
-void
-highlighturlsline(int row)
-{
-	char *linestr = calloc(sizeof(char), term.col+1); /* assume ascii */
-	char *match;
-	for (int j = 0; j < term.col; j++) {
-		if (term.line[row][j].u < 127) {
-			linestr[j] = term.line[row][j].u;
-		}
-		linestr[term.col] = '\0';
-	}
-	int url_start = -1;
-	while ((match = strstrany(linestr + url_start + 1, urlprefixes))) {
-		url_start = match - linestr;
-		for (int c = url_start; c < term.col && strchr(urlchars, linestr[c]); c++) {
-			term.line[row][c].mode |= ATTR_URL;
-			tsetdirt(row, c);
+		while (e < term.col && (c = line[e].u) < 128 && urlclass[c] & 1)
+			e++;
+		if (ul->n == ul->cap) {
+			ul->cap = ul->cap ? ul->cap * 2 : 4;
+			ul->url = xrealloc(ul->url, ul->cap * sizeof(*ul->url));
 		}
+		ul->url[ul->n].b = x;
+		ul->url[ul->n].e = e;
+		ul->n++;
+		x = e - 1;
 	}
-	free(linestr);
+
+	return ul;
 }
 
+/* underlines the URLs of row y of the view in line */
 void
-unhighlighturlsline(int row)
+turlmark(int y, Line line)
 {
-	for (int j = 0; j < term.col; j++) {
-		Glyph* g = &term.line[row][j];
-		if (g->mode & ATTR_URL) {
-			g->mode &= ~ATTR_URL;
-			tsetdirt(row, j);
-		}
+	URLLine *ul = turls(y);
+	int i, x;
+
+	for (x = 0; x < term.col; x++)
+		line[x].mode &= ~ATTR_URL;
+	for (i = 0; i < ul->n; i++) {
+		for (x = ul->url[i].b; x < ul->url[i].e; x++)
+			line[x].mode |= ATTR_URL;
 	}
-	return;
 }
 
 int
-followurl(int col, int row) {
-	char *linestr = calloc(sizeof(char), term.col+1); /* assume ascii */
-	char *match;
-	for (int i = 0; i < term.col; i++) {
-		if (term.line[row][i].u < 127) {
-			linestr[i] = term.line[row][i].u;
-		}
-		linestr[term.col] = '\0';
-	}
-	int url_start = -1, found_url = 0;
-	while ((match = strstrany(linestr + url_start + 1, urlprefixes))) {
-		url_start = match - linestr;
-		int url_end = url_start;
-		for (int c = url_start; c < term.col && strchr(urlchars, linestr[c]); c++) {
-			url_end++;
-		}
-		if (url_start <= col && col < url_end) {
-			found_url = 1;
-			linestr[url_end] = '\0';
+followurl(int col, int row)
+{
+	URLLine *ul = turls(row);
+	Line line = TLINE(row);
+	char *url, *p;
+	pid_t chpid;
+	int i, x;
+
+	for (i = 0; i < ul->n; i++) {
+		if (BETWEEN(col, ul->url[i].b, ul->url[i].e - 1))
 			break;
-		}
 	}
-	if (!found_url) {
-		free(linestr);
+	if (i == ul->n)
 		return 0;
-	}
 
-	pid_t chpid;
+	p = url = xmalloc(ul->url[i].e - ul->url[i].b + 1);
+	for (x = ul->url[i].b; x < ul->url[i].e; x++)
+		*p++ = line[x].u;
+	*p = '\0';
+
 	if ((chpid = fork()) == 0) {
 		if (fork() == 0)
-			execlp(urlhandler, urlhandler, linestr + url_start, NULL);
+			execlp(urlhandler, urlhandler, url, NULL);
 		exit(1);
 	}
 	if (chpid > 0)
 		waitpid(chpid, NULL, 0);
-	free(linestr);
-    return 1;
+	free(url);
+	return 1;
 }
 
 void
@@ -917,6 +1117,7 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 			    line, strerror(errno));
 		dup2(cmdfd, 0);
 		stty(args);
+		fcntl(cmdfd, F_SETFL, fcntl(cmdfd, F_GETFL) | O_NONBLOCK);
 		return cmdfd;
 	}
 
@@ -951,6 +1152,7 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 			die("pledge\n");
 #endif
 		fcntl(m, F_SETFD, FD_CLOEXEC);
+		fcntl(m, F_SETFL, fcntl(m, F_GETFL) | O_NONBLOCK);
 		close(s);
 		cmdfd = m;
 		signal(SIGCHLD, sigchld);
@@ -959,30 +1161,108 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 	return cmdfd;
 }
 
+/*
+ * Drains the tty into a buffer which starts at BUFSIZ and doubles, up to
+ * ttybufsize, while reads keep filling it. Parsing stops after
+ * ttyreadmax bytes or ttyreadtime ms so X events and drawing get a turn
+ * under heavy output.
+ *
+ * ttywriteraw() calls back in here while twrite() is still parsing buf,
+ * e.g. to answer DA or DSR. Such a nested read only queues its bytes in
+ * pend, which are parsed after the rest of buf.
+ */
 size_t
 ttyread(void)
 {
-	static char buf[BUFSIZ];
-	static int buflen = 0;
-	int ret, written;
+	static char *buf, *pend;
+	static size_t bufsiz, buflen, pendsiz, pendlen;
+	static int parsing;
+	struct timespec start, now;
+	size_t total = 0;
+	ssize_t ret;
+	int written;
+
+	if (parsing) {
+		if (pendlen == pendsiz) {
+			pendsiz = pendsiz ? pendsiz * 2 : BUFSIZ;
+			pend = xrealloc(pend, pendsiz);
+		}
+		ret = read(cmdfd, pend+pendlen, pendsiz-pendlen);
+		if (ret == 0)
+			exit(0);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+			die("couldn't read from shell: %s\n", strerror(errno));
+		}
+		ttyreads++;
+		ttybytes += ret;
+		pendlen += ret;
+		return ret;
+	}
 
-	/* append read bytes to unprocessed bytes */
-	ret = read(cmdfd, buf+buflen, LEN(buf)-buflen);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		if (!buf) {
+			bufsiz = BUFSIZ;
+			buf = xmalloc(bufsiz);
+		}
+
+		/* append read bytes to unprocessed bytes */
+		ret = read(cmdfd, buf+buflen, bufsiz-buflen);
+		if (ret == 0)
+			exit(0);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			die("couldn't read from shell: %s\n", strerror(errno));
+		}
+
+		ttyreads++;
+		ttybytes += ret;
+		total += ret;
+		if (buflen + ret == bufsiz && bufsiz < ttybufsize) {
+			bufsiz = MIN(bufsiz * 2, ttybufsize);
+			buf = xrealloc(buf, bufsiz);
+		}
 
-	switch (ret) {
-	case 0:
-		exit(0);
-	case -1:
-		die("couldn't read from shell: %s\n", strerror(errno));
-	default:
 		buflen += ret;
-		written = twrite(buf, buflen, 0);
-		buflen -= written;
-		/* keep any incomplete UTF-8 byte sequence for the next call */
-		if (buflen > 0)
-			memmove(buf, buf + written, buflen);
-		return ret;
+		for (;;) {
+			parsing = 1;
+			written = twrite(buf, buflen, 0);
+			parsing = 0;
+			buflen -= written;
+			/* keep any incomplete UTF-8 byte sequence for the next call */
+			if (buflen > 0)
+				memmove(buf, buf + written, buflen);
+			if (pendlen == 0)
+				break;
+
+			if (buflen + pendlen > bufsiz) {
+				bufsiz = buflen + pendlen;
+				buf = xrealloc(buf, bufsiz);
+			}
+			memcpy(buf + buflen, pend, pendlen);
+			buflen += pendlen;
+			pendlen = 0;
+		}
+
+		if (total >= ttyreadmax)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (TIMEDIFF(now, start) >= ttyreadtime)
+			break;
 	}
+
+	return total;
+}
+
+void
+ttyreadstats(size_t *bytes, size_t *reads)
+{
+	*bytes = ttybytes;
+	*reads = ttyreads;
+	ttybytes = ttyreads = 0;
 }
 
 void
@@ -1047,16 +1327,21 @@ ttywriteraw(const char *s, size_t n)
 			 * default of 256. This seems to be a reasonable value
 			 * for a serial line. Bigger values might clog the I/O.
 			 */
-			if ((r = write(cmdfd, s, (n < lim)? n : lim)) < 0)
-				goto write_error;
+			if ((r = write(cmdfd, s, (n < lim)? n : lim)) < 0) {
+				if (errno != EAGAIN && errno != EINTR)
+					goto write_error;
+				r = 0;
+			}
 			if (r < n) {
 				/*
 				 * We weren't able to write out everything.
 				 * This means the buffer is getting full
 				 * again. Empty it.
 				 */
-				if (n < lim)
+				if (n < lim) {
 					lim = ttyread();
+					LIMIT(lim, 1, BUFSIZ);
+				}
 				n -= r;
 				s += r;
 			} else {
@@ -1064,8 +1349,10 @@ ttywriteraw(const char *s, size_t n)
 				break;
 			}
 		}
-		if (FD_ISSET(cmdfd, &rfd))
+		if (FD_ISSET(cmdfd, &rfd)) {
 			lim = ttyread();
+			LIMIT(lim, 1, BUFSIZ);
+		}
 	}
 	return;
 
@@ -1347,7 +1634,10 @@ kscrollup(const Arg* a)
 	if (n < 0)
 		n = term.row + n;
 
-	if (term.scr <= HISTSIZE-n) {
+	if (n > term.histn - term.scr)
+		n = term.histn - term.scr;
+
+	if (n > 0) {
 		term.scr += n;
 		selscroll(0, n);
 		tfulldirt();
@@ -1362,12 +1652,8 @@ tscrolldown(int orig, int n, int copyhist)
 
 	LIMIT(n, 0, term.bot-orig+1);
 
-	if (copyhist) {
-		term.histi = (term.histi - 1 + HISTSIZE) % HISTSIZE;
-		temp = term.hist[term.histi];
-		term.hist[term.histi] = term.line[term.bot];
-		term.line[term.bot] = temp;
-	}
+	if (copyhist)
+		thistreplace(term.line[term.bot]);
 
 	tsetdirt(orig, term.bot-n);
 	tclearregion(0, term.bot-n+1, term.col-1, term.bot);
@@ -1391,14 +1677,12 @@ tscrollup(int orig, int n, int copyhist)
 	LIMIT(n, 0, term.bot-orig+1);
 
 	if (copyhist) {
-		term.histi = (term.histi + 1) % HISTSIZE;
-		temp = term.hist[term.histi];
-		term.hist[term.histi] = term.line[orig];
-		term.line[orig] = temp;
+		for (i = orig; i < orig+n; i++)
+			thistpush(term.line[i]);
 	}
 
-	if (term.scr > 0 && term.scr < HISTSIZE)
-		term.scr = MIN(term.scr + n, HISTSIZE-1);
+	if (term.scr > 0)
+		term.scr = MIN(term.scr + n, term.histn);
 
 	tclearregion(0, orig, term.col-1, orig+n-1);
 	tsetdirt(orig+n, term.bot);
@@ -2372,10 +2656,8 @@ void
 externalpipe(const Arg *arg)
 {
 	int to[2];
-	char buf[UTF_SIZ];
-	void (*oldsigpipe)(int);
-	Glyph *bp, *end;
-	int lastpos, n, newline;
+	char *buf = NULL;
+	size_t len, siz = 0;
 
 	if (pipe(to) == -1)
 		return;
@@ -2396,31 +2678,18 @@ externalpipe(const Arg *arg)
 	}
 
 	close(to[0]);
-	/* ignore sigpipe for now, in case child exists early */
-	oldsigpipe = signal(SIGPIPE, SIG_IGN);
-	newline = 0;
-	for (n = 0; n <= HISTSIZE + 2; n++) {
-		bp = TLINE_HIST(n);
-		lastpos = MIN(tlinehistlen(n) + 1, term.col) - 1;
-		if (lastpos < 0)
-			break;
-        if (lastpos == 0)
-            continue;
-		end = &bp[lastpos + 1];
-		for (; bp < end; ++bp)
-			if (xwrite(to[1], buf, utf8encode(bp->u, buf)) < 0)
-				break;
-		if ((newline = TLINE_HIST(n)[lastpos].mode & ATTR_WRAP))
-			continue;
-		if (xwrite(to[1], "\n", 1) < 0)
-			break;
-		newline = 0;
+	/*
+	 * The scrollback is encoded and written by a child working on its
+	 * own copy of the terminal, so st keeps going while the consumer
+	 * reads. Ignore sigpipe, in case the consumer exits early.
+	 */
+	if (fork() == 0) {
+		signal(SIGPIPE, SIG_IGN);
+		len = texport(&buf, &siz, -term.histn, term.row, 1);
+		xwrite(to[1], buf, len);
+		_exit(0);
 	}
-	if (newline)
-		(void)xwrite(to[1], "\n", 1);
 	close(to[1]);
-	/* restore */
-	signal(SIGPIPE, oldsigpipe);
 }
 
 void
@@ -2530,25 +2799,74 @@ tdumpsel(void)
 void
 tdumpline(int n)
 {
-	char buf[UTF_SIZ];
-	const Glyph *bp, *end;
+	char *buf = NULL;
+	size_t len, siz = 0;
 
-	bp = &term.line[n][0];
-	end = &bp[MIN(tlinelen(n), term.col) - 1];
-	if (bp != end || bp->u != ' ') {
-		for ( ; bp <= end; ++bp)
-			tprinter(buf, utf8encode(bp->u, buf));
-	}
-	tprinter("\n", 1);
+	len = texport(&buf, &siz, n, n + 1, 0);
+	tprinter(buf, len);
+	free(buf);
 }
 
 void
 tdump(void)
 {
-	int i;
+	char *buf = NULL;
+	size_t len, siz = 0;
 
-	for (i = 0; i < term.row; ++i)
-		tdumpline(i);
+	len = texport(&buf, &siz, 0, term.row, 0);
+	tprinter(buf, len);
+	free(buf);
+}
+
+/*
+ * Encodes lines first to last - 1 as UTF-8 text into *buf, which is grown
+ * as needed, and returns its length. History lines are negative, -1 being
+ * the newest one. With flow, wrapped lines are joined and empty lines are
+ * skipped. Otherwise each line ends with a newline.
+ */
+size_t
+texport(char **buf, size_t *siz, int first, int last, int flow)
+{
+	Line hline = NULL;
+	const Glyph *bp, *end;
+	size_t n = 0;
+	int y, len, wrap, wrapped = 0;
+
+	for (y = first; y < last; y++) {
+		if (y < 0) {
+			if (!hline)
+				hline = xmalloc(term.maxcol * sizeof(Glyph));
+			thistexpand(term.hist[(term.histi + y + term.histcap)
+			                      % term.histcap], hline);
+			bp = hline;
+		} else {
+			bp = term.line[y];
+		}
+
+		len = term.col;
+		if (!(wrap = bp[len - 1].mode & ATTR_WRAP)) {
+			while (len > 0 && bp[len - 1].u == ' ')
+				--len;
+		}
+		if (flow && len == 0)
+			continue;
+
+		if (*siz - n < (size_t)len * UTF_SIZ + 2) {
+			*siz = MAX(*siz * 2, n + len * UTF_SIZ + 2);
+			*buf = xrealloc(*buf, *siz);
+		}
+		for (end = bp + len; bp < end; ++bp) {
+			if (!(bp->mode & ATTR_WDUMMY))
+				n += utf8encode(bp->u, *buf + n);
+		}
+		if (!flow || !(wrapped = wrap))
+			(*buf)[n++] = '\n';
+	}
+	if (wrapped)
+		(*buf)[n++] = '\n';
+	free(hline);
+
+	return n;
 }
 
 void
@@ -2962,6 +3280,105 @@ check_control_code:
 	}
 }
 
+/*
+ * Prints a run of printable ASCII characters. They need none of the
+ * sequence, charset and wide character handling of tputc(), so the run
+ * is copied into the line up to the wrap point in one go.
+ */
+void
+tputascii(const char *s, int len)
+{
+	int i, n, x, y;
+	Glyph *gp;
+
+	if (IS_SET(MODE_PRINT))
+		tprinter((char *)s, len);
+
+	term.lastc = (uchar)s[len - 1];
+	while (len > 0) {
+		if (term.c.state & CURSOR_WRAPNEXT) {
+			term.line[term.c.y][term.c.x].mode |= ATTR_WRAP;
+			tnewline(1);
+		}
+		x = term.c.x;
+		y = term.c.y;
+		n = MIN(len, term.col - x);
+		gp = &term.line[y][x];
+
+		if (sel.ob.x != -1) {
+			for (i = x; i < x + n; i++) {
+				if (selected(i, y)) {
+					selclear();
+					break;
+				}
+			}
+		}
+
+		/* don't leave half of a wide character at either end */
+		if (gp[0].mode & ATTR_WDUMMY) {
+			gp[-1].u = ' ';
+			gp[-1].mode &= ~ATTR_WIDE;
+		}
+		if ((gp[n-1].mode & ATTR_WIDE) && x + n < term.col) {
+			gp[n].u = ' ';
+			gp[n].mode &= ~ATTR_WDUMMY;
+		}
+
+		for (i = 0; i < n; i++) {
+			gp[i] = term.c.attr;
+			gp[i].u = (uchar)s[i];
+		}
+		term.dirty[y] = 1;
+		s += n;
+		len -= n;
+
+		if (x + n < term.col) {
+			tmoveto(x + n, y);
+		} else {
+			term.c.x = term.col - 1;
+			term.c.state |= CURSOR_WRAPNEXT;
+		}
+	}
+}
+
+/* returns the length of the printable ASCII run at the start of s */
+int
+asciilen(const char *s, int len)
+{
+	int n = 0;
+#if defined(__AVX2__)
+	const __m256i lo = _mm256_set1_epi8(0x1f), del = _mm256_set1_epi8(0x7f);
+	__m256i v;
+	uint32_t m;
+
+	/* bytes from 0x80 compare as negative, so they fail the signed test */
+	for (; n + 32 <= len; n += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(s + n));
+		m = _mm256_movemask_epi8(_mm256_andnot_si256(
+		        _mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, lo)));
+		if (m != 0xFFFFFFFF)
+			return n + __builtin_ctz(~m);
+	}
+#elif defined(__SSE2__)
+	const __m128i lo = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+	__m128i v;
+	uint32_t m;
+
+	/* bytes from 0x80 compare as negative, so they fail the signed test */
+	for (; n + 16 <= len; n += 16) {
+		v = _mm_loadu_si128((const __m128i *)(s + n));
+		m = _mm_movemask_epi8(_mm_andnot_si128(
+		        _mm_cmpeq_epi8(v, del), _mm_cmpgt_epi8(v, lo)));
+		if (m != 0xFFFF)
+			return n + __builtin_ctz(~m);
+	}
+#endif
+	while (n < len && BETWEEN((uchar)s[n], 0x20, 0x7e))
+		n++;
+
+	return n;
+}
+
 int
 twrite(const char *buf, int buflen, int show_ctrl)
 {
@@ -2970,6 +3387,13 @@ twrite(const char *buf, int buflen, int show_ctrl)
 	int n;
 
 	for (n = 0; n < buflen; n += charsize) {
+		/* plain text outside of any sequence takes the bulk path */
+		if (!term.esc && IS_SET(MODE_WRAP) && !IS_SET(MODE_INSERT) &&
+		    term.trantbl[term.charset] != CS_GRAPHIC0 &&
+		    (charsize = asciilen(buf + n, buflen - n)) > 0) {
+			tputascii(buf + n, charsize);
+			continue;
+		}
 		if (IS_SET(MODE_UTF8)) {
 			/* process a complete utf8 char */
 			charsize = utf8decode(buf + n, &u, buflen - n);
@@ -2997,7 +3421,7 @@ twrite(const char *buf, int buflen, int show_ctrl)
 void
 tresize(int col, int row)
 {
-	int i, j;
+	int i;
 	int tmp;
 	int minrow, mincol;
 	int *bp;
@@ -3046,13 +3470,22 @@ tresize(int col, int row)
 	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
 	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
 
-	for (i = 0; i < HISTSIZE; i++) {
-		term.hist[i] = xrealloc(term.hist[i], col * sizeof(Glyph));
-		for (j = mincol; j < col; j++) {
-			term.hist[i][j] = term.c.attr;
-			term.hist[i][j].u = ' ';
-		}
-	}
+	/* history lines are expanded on demand, only the view is resized */
+	for (i = 0; i < term.row; i++)
+		free(term.view[i]);
+	for (i = row; i < term.row; i++)
+		free(term.urls[i].url);
+	term.view = xrealloc(term.view, row * sizeof(Line));
+	term.viewseq = xrealloc(term.viewseq, row * sizeof(*term.viewseq));
+	term.urls = xrealloc(term.urls, row * sizeof(*term.urls));
+	for (i = 0; i < row; i++) {
+		term.view[i] = xmalloc(col * sizeof(Glyph));
+		term.viewseq[i] = 0;
+		if (i >= term.row)
+			term.urls[i] = (URLLine){ .url = NULL, .cap = 0 };
+		term.urls[i].n = -1;
+	}
+	term.scr = MIN(term.scr, term.histn);
 
 	/* resize each row to new width, zero-pad if needed */
 	for (i = 0; i < minrow; i++) {
@@ -3106,6 +3539,7 @@ resettitle(void)
 void
 drawregion(int x1, int y1, int x2, int y2)
 {
+	Line line;
 	int y;
 
 	for (y = y1; y < y2; y++) {
@@ -3113,9 +3547,9 @@ drawregion(int x1, int y1, int x2, int y2)
 			continue;
 
 		term.dirty[y] = 0;
-		unhighlighturlsline(y);
-		highlighturlsline(y);
-		xdrawline(TLINE(y), x1, y, x2);
+		line = TLINE(y);
+		turlmark(y, line);
+		xdrawline(line, x1, y, x2);
 	}
 }
 
@@ -3370,96 +3804,49 @@ int trt_kbdselect(KeySym ksym, char *buf, int len) {
 	return 0;
 }
 
-int
-daddch(URLdfa *dfa, char c)
-{
-	/* () and [] can appear in urls, but excluding them here will reduce false
-	 * positives when figuring out where a given url ends.
-	 */
-	static const char URLCHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-		"abcdefghijklmnopqrstuvwxyz"
-		"0123456789-._~:/?#@!$&'*+,;=%";
-	static const char RPFX[] = "//:sptth";
-
-	if (!strchr(URLCHARS, c)) {
-		dfa->length = 0;
-		dfa->state = 0;
-
-		return 0;
-	}
-
-	dfa->length++;
-
-	if (dfa->state == 2 && c == '/') {
-		dfa->state = 0;
-	} else if (dfa->state == 3 && c == 'p') {
-		dfa->state++;
-	} else if (c != RPFX[dfa->state]) {
-		dfa->state = 0;
-		return 0;
-	}
-
-	if (dfa->state++ == 7) {
-		dfa->state = 0;
-		return 1;
-	}
-
-	return 0;
-}
-
 /*
 ** Select and copy the previous url on screen (do nothing if there's no url).
 */
 void
 copyurl(const Arg *arg) {
-	int row = 0, /* row of current URL */
-		col = 0, /* column of current URL start */
-		colend = 0, /* column of last occurrence */
-		passes = 0; /* how many rows have been scanned */
+	URLLine *ul;
+	int row, col, i, passes;
 
-	const char *c = NULL,
-		 *match = NULL;
-	URLdfa dfa = { 0 };
-
-	row = (sel.ob.x >= 0 && sel.nb.y > 0) ? sel.nb.y : term.bot;
+	row = (sel.ob.x >= 0) ? sel.nb.y : term.bot;
 	LIMIT(row, term.top, term.bot);
 
-	colend = (sel.ob.x >= 0 && sel.nb.y > 0) ? sel.nb.x : term.col;
-	LIMIT(colend, 0, term.col);
+	col = (sel.ob.x >= 0) ? sel.nb.x : arg->i ? -1 : term.col;
 
-	/*
-	** Scan from (term.row - 1,term.col - 1) to (0,0) and find
-	** next occurrance of a URL
-	*/
+	/* .i = 0 --> bottom-up
+	 * .i = 1 --> top-down
+	 */
 	for (passes = 0; passes < term.row; passes++) {
-		/* Read in each column of every row until
-		** we hit previous occurrence of URL
-		*/
-		for (col = colend; col--;)
-			if (daddch(&dfa, term.line[row][col].u < 128 ? term.line[row][col].u : ' '))
-				break;
-
-		if (col >= 0)
+		ul = turls(row);
+		if (!arg->i) {
+			for (i = ul->n - 1; i >= 0 && ul->url[i].b >= col; i--)
+				;
+		} else {
+			for (i = 0; i < ul->n && ul->url[i].b <= col; i++)
+				;
+		}
+		if (i >= 0 && i < ul->n)
 			break;
 
-        /* .i = 0 --> botton-up
-         * .i = 1 --> top-down
-         */
-        if (!arg->i) {
-            if (--row < 0)
-                row = term.row - 1;
-        } else {
-            if (++row >= term.row)
-                row = 0;
-        }
-
-		colend = term.col;
+		if (!arg->i) {
+			if (--row < 0)
+				row = term.row - 1;
+			col = term.col;
+		} else {
+			if (++row >= term.row)
+				row = 0;
+			col = -1;
+		}
 	}
 
 	if (passes < term.row) {
-		selstart(col, row, 0);
-		selextend((col + dfa.length - 1) % term.col, row + (col + dfa.length - 1) / term.col, SEL_REGULAR, 0);
-		selextend((col + dfa.length - 1) % term.col, row + (col + dfa.length - 1) / term.col, SEL_REGULAR, 1);
+		selstart(ul->url[i].b, row, 0);
+		selextend(ul->url[i].e - 1, row, SEL_REGULAR, 0);
+		selextend(ul->url[i].e - 1, row, SEL_REGULAR, 1);
 		xsetsel(getsel());
 		xclipcopy();
 	}
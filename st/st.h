@@ -113,6 +113,7 @@ void tsetdirtattr(int);
 void ttyhangup(void);
 int ttynew(const char *, char *, const char *, char **);
 size_t ttyread(void);
+void ttyreadstats(size_t *, size_t *);
 void ttyresize(int, int);
 void ttywrite(const char *, size_t, int);
 
@@ -125,8 +126,6 @@ void selextend(int, int, int, int);
 int selected(int, int);
 char *getsel(void);
 
-void highlighturlsline(int);
-void unhighlighturlsline(int);
 int followurl(int, int);
 
 size_t utf8encode(Rune, char *);
@@ -167,6 +166,11 @@ extern int allowaltscreen;
 extern int allowwindowops;
 extern char *termname;
 extern unsigned int tabspaces;
+extern unsigned int histsize;
+extern int histcompact;
+extern unsigned int ttybufsize;
+extern unsigned int ttyreadmax;
+extern unsigned int ttyreadtime;
 extern unsigned int defaultfg;
 extern unsigned int defaultbg;
 extern unsigned int defaultcs;
@@ -175,7 +179,6 @@ extern const int boxdraw, boxdraw_bold, boxdraw_braille;
 extern char *urlhandler;
 extern char urlchars[];
 extern char *urlprefixes[];
-extern int nurlprefixes;
 extern char *iso14755_cmd;
 extern float alpha_def;
 extern char *bgfile;
@@ -98,6 +98,7 @@ static void ttysend(const Arg *);
 static void chgalpha(const Arg *);
 static void chgbgimgalpha(const Arg *);
 static void cyclefonts(const Arg *);
+static void printstats(const Arg *);
 
 /* config.h for applying patches and the configuration. */
 #include "config.h"
@@ -193,6 +194,7 @@ static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int)
 static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int, int);
 static void xdrawglyph(Glyph, int, int);
 static void xclear(int, int, int, int);
+static void xdamage(int, int);
 static int xgeommasktogravity(int);
 static int ximopen(Display *);
 static void ximinstantiate(Display *, XPointer, XPointer);
@@ -298,6 +300,25 @@ typedef struct {
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+
+/*
+ * Glyph lookup cache, an open addressing table keyed by rune and FRC
+ * flags. It remembers which font xmakeglyphfontspecs() settled on, so
+ * a redraw does not ask Xft again. Emptied whenever fonts are unloaded.
+ */
+typedef struct {
+	uint32_t key; /* (rune << 2 | frcflags) + 1, 0 for a free slot */
+	int fallback;
+	XftFont *font;
+	FT_UInt glyph;
+} Glyphcache;
+
+static Glyphcache *glc = NULL;
+static int glclen = 0;
+static int glccap = 0;
+
+static Glyphcache *glcfind(Rune, int);
+static void glcadd(Rune, int, XftFont *, FT_UInt, int);
 static char *usedfont = NULL;
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
@@ -320,6 +341,18 @@ static char *opt_line  = NULL;
 static char *opt_name  = NULL;
 static char *opt_title = NULL;
 
+/* statistics since the last printstats() */
+static struct timespec statstime;
+static ulong statsframes;
+static double statsdrawtime, statsdrawmax;
+static double statspresented;
+
+/* horizontal bands of xw.buf drawn since the last xfinishdraw() */
+#define MAXDAMAGE 16
+static struct { int y1, y2; } damage[MAXDAMAGE];
+static int ndamage;
+static struct timespec drawstart;
+
 static uint buttons; /* bit field of pressed buttons */
 static int cursorblinks = 0;
 static int focused = 0;
@@ -405,6 +438,30 @@ ttysend(const Arg *arg)
 	ttywrite(arg->s, strlen(arg->s), 1);
 }
 
+void
+printstats(const Arg *arg)
+{
+	struct timespec now;
+	size_t bytes, reads;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = TIMEDIFF(now, statstime) / 1E3;
+	ttyreadstats(&bytes, &reads);
+	fprintf(stderr, "st: %.0f bytes/s, %zu reads, %.2f reads/frame, "
+	        "%.1f frames/s over %.1fs\n", bytes / secs, reads,
+	        statsframes ? (double)reads / statsframes : 0.0,
+	        statsframes / secs, secs);
+	if (statsframes)
+		fprintf(stderr, "st: %.2f ms/frame avg, %.2f ms max, "
+		        "%.0f%% of the window presented\n",
+		        statsdrawtime / statsframes, statsdrawmax,
+		        100 * statspresented / statsframes);
+	statstime = now;
+	statsframes = 0;
+	statsdrawtime = statsdrawmax = statspresented = 0;
+}
+
 void
 cyclefonts(const Arg *arg)
 {
@@ -1113,6 +1170,8 @@ xclear(int x1, int y1, int x2, int y2)
 {
 	Pixmap bgpm = bgimg_pixmap();
 
+	xdamage(y1, y2);
+
 	/* Reverse video does not use the image */
 	if (bgpm != None && !IS_SET(MODE_REVERSE)) {
 		XCopyArea(xw.dpy, bgpm, xw.buf, dc.gc,
@@ -1445,6 +1504,12 @@ xunloadfonts(void)
 	while (frclen > 0)
 		XftFontClose(xw.dpy, frc[--frclen].font);
 
+	/* the glyph cache points into those fonts */
+	if (glclen) {
+		memset(glc, 0, glccap * sizeof(*glc));
+		glclen = 0;
+	}
+
 	xunloadfont(&dc.font);
 	xunloadfont(&dc.bfont);
 	xunloadfont(&dc.ifont);
@@ -1666,6 +1731,50 @@ xinit(int w, int h)
 	boxdraw_xinit(xw.dpy, xw.cmap, xw.draw, xw.vis);
 }
 
+Glyphcache *
+glcfind(Rune rune, int frcflags)
+{
+	uint32_t key = ((uint32_t)rune << 2 | frcflags) + 1;
+	uint32_t i;
+
+	if (!glccap)
+		return NULL;
+	for (i = key * 2654435761u; ; i++) {
+		i &= glccap - 1;
+		if (glc[i].key == key || !glc[i].key)
+			return &glc[i];
+	}
+}
+
+void
+glcadd(Rune rune, int frcflags, XftFont *font, FT_UInt glyph, int fallback)
+{
+	Glyphcache *old = glc, *e;
+	int i, oldcap = glccap;
+
+	/* keep the load under 3/4 */
+	if (4 * (glclen + 1) > 3 * glccap) {
+		glccap = glccap ? glccap * 2 : 1024;
+		glc = xmalloc(glccap * sizeof(*glc));
+		memset(glc, 0, glccap * sizeof(*glc));
+		for (i = 0; i < oldcap; i++) {
+			if (!old[i].key)
+				continue;
+			e = glcfind((old[i].key - 1) >> 2, (old[i].key - 1) & 3);
+			*e = old[i];
+		}
+		free(old);
+	}
+
+	e = glcfind(rune, frcflags);
+	if (!e->key)
+		glclen++;
+	e->key = ((uint32_t)rune << 2 | frcflags) + 1;
+	e->font = font;
+	e->glyph = glyph;
+	e->fallback = fallback;
+}
+
 int
 xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
 {
@@ -1680,6 +1789,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 	FcPattern *fcpattern, *fontpattern;
 	FcFontSet *fcsets[] = { NULL };
 	FcCharSet *fccharset;
+	Glyphcache *e;
 	int i, f, numspecs = 0;
 
 	for (i = 0, xp = winx, yp = winy + font->ascent + win.cyo; i < len; ++i) {
@@ -1713,9 +1823,19 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		if (mode & ATTR_BOXDRAW) {
 			/* minor shoehorning: boxdraw uses only this ushort */
 			glyphidx = boxdrawindex(&glyphs[i]);
+		} else if ((e = glcfind(rune, frcflags)) && e->key) {
+			specs[numspecs].font = e->font;
+			specs[numspecs].glyph = e->glyph;
+			specs[numspecs].x = (short)xp + (e->fallback ? 0 : cxoffset);
+			specs[numspecs].y = (short)yp + (e->fallback ? 0 : cyoffset);
+			xp += runewidth;
+			numspecs++;
+			continue;
 		} else {
 			/* Lookup character index with default font. */
 			glyphidx = XftCharIndex(xw.dpy, font->match, rune);
+			if (glyphidx)
+				glcadd(rune, frcflags, font->match, glyphidx, 0);
 		}
 		if (glyphidx) {
 			specs[numspecs].font = font->match;
@@ -1792,6 +1912,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 			FcCharSetDestroy(fccharset);
 		}
 
+		glcadd(rune, frcflags, frc[f].font, glyphidx, 1);
 		specs[numspecs].font = frc[f].font;
 		specs[numspecs].glyph = glyphidx;
 		specs[numspecs].x = (short)xp;
@@ -1855,8 +1976,11 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 	    width = charlen * win.cw;
 	Color *fg, *bg, *temp, revfg, revbg, truefg, truebg;
 	XRenderColor colfg, colbg;
+
 	XRectangle r;
 
+	xdamage(winy, winy + win.ch);
+
 	/* Fallback on color display for attributes not supported by the font */
 	if (base.mode & ATTR_ITALIC && base.mode & ATTR_BOLD) {
 		if (dc.ibfont.badslant || dc.ibfont.badweight)
@@ -2006,6 +2130,9 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 	Color drawcol;
 	XRenderColor colbg;
 
+	/* bar, underline and hollow cursors are drawn without xdrawglyph() */
+	xdamage(win.vborderpx + cy * win.ch, win.vborderpx + (cy + 1) * win.ch);
+
 	/* remove the old cursor */
 	if (selected(ox, oy))
 		og.mode ^= ATTR_REVERSE;
@@ -2185,11 +2312,44 @@ xpushtitle(void)
 	tstki = tstkin;
 }
 
+/*
+ * Record that pixel rows y1 to y2 of xw.buf changed. Touching or
+ * overlapping bands are merged; past MAXDAMAGE everything collapses
+ * into one band.
+ */
+void
+xdamage(int y1, int y2)
+{
+	int i, j;
+
+	LIMIT(y1, 0, win.h);
+	LIMIT(y2, 0, win.h);
+	if (y1 >= y2)
+		return;
+
+	for (i = 0; i < ndamage; i++) {
+		if (y1 > damage[i].y2 || y2 < damage[i].y1)
+			continue;
+		y1 = MIN(y1, damage[i].y1);
+		y2 = MAX(y2, damage[i].y2);
+		damage[i--] = damage[--ndamage];
+	}
+	if (ndamage == MAXDAMAGE) {
+		for (j = 0; j < ndamage; j++) {
+			y1 = MIN(y1, damage[j].y1);
+			y2 = MAX(y2, damage[j].y2);
+		}
+		ndamage = 0;
+	}
+	damage[ndamage].y1 = y1;
+	damage[ndamage].y2 = y2;
+	ndamage++;
+}
+
 int
 xstartdraw(void)
 {
-	if (IS_SET(MODE_VISIBLE))
-		XCopyArea(xw.dpy, xw.win, xw.buf, dc.gc, 0, 0, win.w, win.h, 0, 0);
+	clock_gettime(CLOCK_MONOTONIC, &drawstart);
 	return IS_SET(MODE_VISIBLE);
 }
 
@@ -2234,8 +2394,25 @@ xdrawline(Line line, int x1, int y1, int x2)
 void
 xfinishdraw(void)
 {
-	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
-			win.h, 0, 0);
+	struct timespec now;
+	double ms;
+	int i, h = 0;
+
+	/* xw.buf always holds the whole frame, present only what changed */
+	for (i = 0; i < ndamage; i++) {
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, damage[i].y1,
+				win.w, damage[i].y2 - damage[i].y1,
+				0, damage[i].y1);
+		h += damage[i].y2 - damage[i].y1;
+	}
+	ndamage = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = TIMEDIFF(now, drawstart);
+	statsdrawtime += ms;
+	statsdrawmax = MAX(statsdrawmax, ms);
+	statspresented += win.h ? (double)h / win.h : 0;
+
 	XSetForeground(xw.dpy, dc.gc,
 			dc.col[IS_SET(MODE_REVERSE)?
 				defaultfg : defaultbg].pixel);
@@ -2256,7 +2433,12 @@ xximspot(int x, int y)
 void
 expose(XEvent *ev)
 {
-	redraw();
+	XExposeEvent *e = &ev->xexpose;
+
+	/* xw.buf is intact, so only present the exposed band again */
+	xdamage(e->y, e->y + e->height);
+	if (e->count == 0)
+		draw();
 }
 
 void
@@ -2755,6 +2937,7 @@ run(void)
 
 	ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
 	cresize(w, h);
+	clock_gettime(CLOCK_MONOTONIC, &statstime);
 
 	for (timeout = -1, drawing = 0, lastblink = (struct timespec){0};;) {
 		FD_ZERO(&rfd);
@@ -2840,6 +3023,7 @@ run(void)
 
 		draw();
 		XFlush(xw.dpy);
+		statsframes++;
 		drawing = 0;
 	}
 }
@@ -2902,12 +3086,12 @@ usage(void)
 {
 	die("usage: %s [-aiv] [-A alpha] [-I bgimage] [-b borderpx] [-c class] [-f font]"
 	    " [-g geometry] [-G geometry]\n"
-	    "          [-n name] [-o file]"
+	    "          [-H histsize] [-n name] [-o file]"
 	    " [-T title] [-t title] [-w windowid]"
 	    " [[-e] command [args ...]]\n"
 	    "       %s [-aiv] [-A alpha] [-I bgimage] [-b borderpx] [-c class] [-f font]"
 	    " [-g geometry] [-G geometry]\n"
-	    "          [-n name] [-o file]"
+	    "          [-H histsize] [-n name] [-o file]"
 	    " [-T title] [-t title] [-w windowid] -l line"
 	    " [stty_args ...]\n", argv0, argv0);
 }
@@ -2957,6 +3141,9 @@ main(int argc, char *argv[])
 				&xw.l, &xw.t, &width, &height);
 		geometry = PixelGeometry;
 		break;
+	case 'H':
+		histsize = atoi(EARGF(usage()));
+		break;
 	case 'I':
 		opt_bgfile = EARGF(usage());
 		break;